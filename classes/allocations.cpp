@@ -0,0 +1,61 @@
+#include "../headers/allocations.h"
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<unsigned long> allocations{0};
+
+static void *counted_alloc(std::size_t size){
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size){
+    return counted_alloc(size);
+}
+void *operator new[](std::size_t size){
+    return counted_alloc(size);
+}
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+void operator delete[](void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+unsigned long allocation_count(){
+    return allocations.load(std::memory_order_relaxed);
+}
+bool counting_allocations(){
+    return true;
+}
+
+#else
+
+unsigned long allocation_count(){
+    return 0;
+}
+bool counting_allocations(){
+    return false;
+}
+
+#endif
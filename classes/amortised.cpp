@@ -0,0 +1,170 @@
+#include "../headers/amortised.h"
+
+// Side of the ordered dither matrix that interleaves the updates
+static const int dither = 8;
+
+AmortisedRenderer::AmortisedRenderer() {
+    this->n = 0;
+    this->l = 0;
+    this->m = 0;
+    this->xmin = 0;
+    this->xmax = 0;
+    this->ymin = 0;
+    this->ymax = 0;
+    this->n_x = 0;
+    this->n_y = 0;
+    this->phi_c = 0;
+    this->theta_c = 0;
+    this->valid = false;
+    this->cursor = 0;
+    this->fresh = 0;
+    this->seen = 0;
+    this->pixel_us = 1;
+}
+
+void AmortisedRenderer::setState(int n, int l, int m, double xmin, double xmax,
+                                 double ymin, double ymax, int n_x, int n_y) {
+    if (valid && n == this->n && l == this->l && m == this->m
+            && xmin == this->xmin && xmax == this->xmax
+            && ymin == this->ymin && ymax == this->ymax
+            && n_x == this->n_x && n_y == this->n_y)
+        return;
+    if (n_x != this->n_x || n_y != this->n_y){
+        this->n_x = n_x;
+        this->n_y = n_y;
+        buildOrder();
+    }
+    this->n = n;
+    this->l = l;
+    this->m = m;
+    this->xmin = xmin;
+    this->xmax = xmax;
+    this->ymin = ymin;
+    this->ymax = ymax;
+    radial.setState(n, l, xmin, xmax, ymin, ymax, n_x, n_y);
+    history.assign(n_x * n_y, complexd_t{0});
+    computed.assign(n_x * n_y, 0);
+    cursor = 0;
+    fresh = 0;
+    seen = 0;
+    valid = true;
+}
+
+// A change of azimuth alone keeps every pixel exact, see rotate_azimuth
+void AmortisedRenderer::setView(double phi_c, double theta_c) {
+    if (phi_c == this->phi_c && theta_c == this->theta_c)
+        return;
+    if (theta_c == this->theta_c){
+        rotate_azimuth(history.data(), history.size(), m, phi_c - this->phi_c);
+        this->phi_c = phi_c;
+        return;
+    }
+    this->phi_c = phi_c;
+    this->theta_c = theta_c;
+    fresh = 0;
+}
+
+// Whether every pixel has been computed at the current camera angles
+bool AmortisedRenderer::converged() {
+    return valid && fresh >= order.size();
+}
+
+const complexd_t *AmortisedRenderer::image() {
+    return history.data();
+}
+
+// Pixels sorted by the rank of their position in an 8x8 Bayer matrix, so
+// that any run of the order covers the image evenly. Within a rank the
+// blocks are visited in a scrambled sequence.
+void AmortisedRenderer::buildOrder() {
+    int bayer[dither][dither] { {0} };
+    for (int size{1}; size < dither; size *= 2)
+        for (int x{0}; x < size; x++)
+            for (int y{0}; y < size; y++){
+                int v { 4 * bayer[x][y] };
+                bayer[x][y] = v;
+                bayer[x + size][y + size] = v + 1;
+                bayer[x + size][y] = v + 2;
+                bayer[x][y + size] = v + 3;
+            }
+
+    int blocks_x { (n_x + dither - 1) / dither };
+    int blocks_y { (n_y + dither - 1) / dither };
+    int blocks { blocks_x * blocks_y };
+    // A multiplier coprime to the block count permutes the blocks
+    int stride { (int)(blocks * 0.618) | 1 };
+    while (std::gcd(stride, blocks) != 1)
+        stride += 2;
+
+    std::vector<int> position(dither * dither);
+    for (int x{0}; x < dither; x++)
+        for (int y{0}; y < dither; y++)
+            position[bayer[x][y]] = x * dither + y;
+
+    order.clear();
+    for (int rank{0}; rank < dither * dither; rank++){
+        int dx { position[rank] / dither };
+        int dy { position[rank] % dither };
+        for (int b{0}; b < blocks; b++){
+            int block { (int)((long long)b * stride % blocks) };
+            int ix { (block / blocks_y) * dither + dx };
+            int iy { (block % blocks_y) * dither + dy };
+            if (ix < n_x && iy < n_y)
+                order.push_back(ix * n_y + iy);
+        }
+    }
+}
+
+// Recomputes as many pixels as fit in budget_us. Pixels that have never
+// been computed show the top left pixel of their 8x8 block, which comes
+// first in the order. Returns whether the image changed.
+bool AmortisedRenderer::update(double budget_us) {
+    if (!valid || converged())
+        return false;
+
+    size_t total { order.size() };
+    size_t count { (size_t)std::max(64.0, budget_us / pixel_us) };
+    count = std::min(count, total - fresh);
+
+    double deltax = (xmax - xmin)/n_x;
+    double deltay = (ymax - ymin)/n_y;
+    double unit_xp[3], unit_yp[3], unit_zp[3];
+    plane_basis(phi_c, theta_c, unit_xp, unit_yp, unit_zp);
+
+    auto start = std::chrono::steady_clock::now();
+    int chunks { (int)std::min<size_t>(count, 4 * ThreadPool::global().size()) };
+    ThreadPool::global().parallel_for(chunks, [&](int c){
+        size_t first { c * count / chunks };
+        size_t last { (c + 1) * count / chunks };
+        for (size_t k{first}; k < last; k++){
+            int i { order[(cursor + k) % total] };
+            double p_coord[3] { xmin + deltax * (i / n_y), ymin + deltay * (i % n_y), 0 };
+            double car_coord[3];
+            convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
+            double sph_coord[3];
+            spherical_from_cart(car_coord, sph_coord);
+            history[i] = radial.at(i / n_y, i % n_y) * Ylm(l, m, sph_coord[1], sph_coord[2]);
+            computed[i] = 1;
+        }
+    });
+    double elapsed { std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start).count() };
+    pixel_us = 0.8 * pixel_us + 0.2 * elapsed / count;
+
+    cursor = (cursor + count) % total;
+    fresh += count;
+    seen = std::min(total, seen + count);
+
+    // Hold the block anchors over pixels that have no history yet. The
+    // anchors themselves are only read, other rows read them meanwhile.
+    if (seen < total){
+        ThreadPool::global().parallel_for(n_x, [&](int ix){
+            for (int iy{0}; iy < n_y; iy++){
+                int i { ix * n_y + iy };
+                if (!computed[i] && (ix % dither != 0 || iy % dither != 0))
+                    history[i] = history[(ix - ix % dither) * n_y + iy - iy % dither];
+            }
+        });
+    }
+    return true;
+}
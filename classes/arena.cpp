@@ -0,0 +1,50 @@
+#include "../headers/arena.h"
+
+Arena::Arena() {
+    this->size = 0;
+    this->used = 0;
+    this->spilled = 0;
+}
+
+void *Arena::raw(size_t bytes, size_t align) {
+    size_t start { (used + align - 1) / align * align };
+    if (start + bytes <= size){
+        used = start + bytes;
+        return block.get() + start;
+    }
+    // new[] is aligned for any fundamental type
+    spill.emplace_back(new unsigned char[bytes ? bytes : 1]);
+    spilled += bytes + align;
+    return spill.back().get();
+}
+
+void Arena::reset() {
+    if (!spill.empty()){
+        // Room for this frame's blocks side by side, with some headroom
+        size = (size + spilled) * 5 / 4;
+        block.reset(new unsigned char[size]);
+        spill.clear();
+        spilled = 0;
+    }
+    used = 0;
+}
+
+size_t Arena::capacity() {
+    return size;
+}
+
+ScratchArenas::ScratchArenas() {
+    this->arenas.resize(ThreadPool::global().size());
+}
+
+Arena &ScratchArenas::local() {
+    return arenas[ThreadPool::thread_index()];
+}
+
+void ScratchArenas::reset() {
+    // The pool may have been resized since
+    if (arenas.size() != (size_t)ThreadPool::global().size())
+        arenas.resize(ThreadPool::global().size());
+    for (Arena &a : arenas)
+        a.reset();
+}
@@ -0,0 +1,31 @@
+#include "../headers/bounds.h"
+
+// Radial interval of the rectangle [x0, x1] x [y0, y1] in a plane through
+// the origin, thickened to a slab |z| <= zmax in the normal direction
+RadialInterval rect_radial_interval(double x0, double x1, double y0, double y1, double zmax){
+    using std::sqrt, std::max, std::abs;
+    // Closest point of the rectangle to the origin
+    double cx = x0 > 0 ? x0 : (x1 < 0 ? x1 : 0);
+    double cy = y0 > 0 ? y0 : (y1 < 0 ? y1 : 0);
+    // Farthest corner
+    double fx = max(abs(x0), abs(x1));
+    double fy = max(abs(y0), abs(y1));
+    return { sqrt(cx*cx + cy*cy), sqrt(fx*fx + fy*fy + zmax*zmax) };
+}
+
+// Radial interval of a ball around an arbitrary point
+RadialInterval sphere_radial_interval(const double centre[3], double radius){
+    double d { std::sqrt(centre[0]*centre[0] + centre[1]*centre[1] + centre[2]*centre[2]) };
+    return { std::max(0.0, d - radius), d + radius };
+}
+
+// Upper bound on |psi_nlm| over a radial interval, valid for every m
+double psi_bound(int n, int l, RadialInterval interval){
+    return Rnl_bound(n, l, interval.r_min, interval.r_max) * Ylm_bound(l);
+}
+
+// Whether every colour channel computed by get_colors would be displayed
+// as black throughout the interval
+bool negligible(int n, int l, RadialInterval interval, double normalization_const){
+    return psi_bound(n, l, interval) / normalization_const < display_threshold;
+}
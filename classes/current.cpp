@@ -0,0 +1,255 @@
+#include "../headers/current.h"
+
+inline const double pi = 3.141592653589793;
+
+// Maximum number of integration steps per streamline
+static const int max_steps = 600;
+
+// Returns psi_nlm at pos and puts its cartesian gradient in grad.
+// With x = 2r/(na) and k = n-l-1,
+//   dR/dr = 2/(na) R (l/x - 1/2 + L'/L), L' = -L_(k-1)^(2l+2)
+//   dP_l^m(cos t)/dt = (l cos t P_l^m - (l+m) P_(l-1)^m) / sin t
+// and phi = atan2(x, y) as in spherical_from_cart, so that
+// grad phi = -phi_hat / (r sin theta) with phi_hat the usual azimuthal unit vector.
+complexd_t grad_psi_nlm(int n, int l, int m, const double pos[3], complexd_t grad[3]){
+    using std::sqrt, std::pow, std::exp, std::assoc_laguerre, std::assoc_legendre, std::polar, std::abs;
+    double sph[3];
+    double p[3] { pos[0], pos[1], pos[2] };
+    spherical_from_cart(p, sph);
+    double r { sph[0] };
+    double rho { sqrt(pos[0]*pos[0] + pos[1]*pos[1]) };
+    // Stay off the origin and the z axis where the spherical basis is singular
+    r = std::max(r, 1e-6 * a0);
+    rho = std::max(rho, 1e-6 * a0);
+    double sin_t { rho / r };
+    double cos_t { pos[2] / r };
+
+    double a = a0;
+    double x = 2*r/(n*a);
+    int k = n - l - 1;
+    double norm = sqrt(pow(2 / (n * a), 3) * fracfac(n, l) / ((n-l) * (2 * n)));
+    double lag = assoc_laguerre(k, 2*l+1, x);
+    double dlag = k > 0 ? -assoc_laguerre(k-1, 2*l+2, x) : 0.0;
+    double radial = norm * exp(-x/2) * pow(x, l) * lag;
+    double dradial = 2/(n*a) * norm * exp(-x/2)
+            * ((l > 0 ? l * pow(x, l-1) : 0.0) * lag - 0.5 * pow(x, l) * lag + pow(x, l) * dlag);
+
+    int am { abs(m) };
+    double ynorm = sqrt((2 * l + 1) / (4 * pi * fracfac(l, am)));
+    double leg = assoc_legendre(l, am, cos_t);
+    double leg_prev = am <= l - 1 ? assoc_legendre(l-1, am, cos_t) : 0.0;
+    double dleg = (l * cos_t * leg - (l + am) * leg_prev) / sin_t;
+    complexd_t phase { polar(1.0, m * sph[2]) };
+    complexd_t y { ynorm * phase * leg };
+    complexd_t dy_dtheta { ynorm * phase * dleg };
+
+    complexd_t psi { radial * y };
+    // Components along r_hat, theta_hat and phi_hat
+    complexd_t g_r { dradial * y };
+    complexd_t g_t { radial / r * dy_dtheta };
+    complexd_t g_p { -radial / (r * sin_t) * complexd_t(0, m) * y };
+
+    double r_hat[3] { pos[0]/r, pos[1]/r, pos[2]/r };
+    double t_hat[3] { pos[2]*pos[0]/(r*rho), pos[2]*pos[1]/(r*rho), -rho/r };
+    double p_hat[3] { -pos[1]/rho, pos[0]/rho, 0 };
+    for (int i{0}; i < 3; i++)
+        grad[i] = g_r * r_hat[i] + g_t * t_hat[i] + g_p * p_hat[i];
+    return psi;
+}
+
+// Probability current Im(psi* grad psi) of a superposition, in units of hbar/m_e
+void probability_current(const std::vector<State> &states, const double pos[3], double j[3]){
+    complexd_t psi{0};
+    complexd_t grad[3] {0, 0, 0};
+    for (const State &s : states){
+        complexd_t g[3];
+        psi += s.c * grad_psi_nlm(s.n, s.l, s.m, pos, g);
+        for (int i{0}; i < 3; i++)
+            grad[i] += s.c * g[i];
+    }
+    for (int i{0}; i < 3; i++)
+        j[i] = std::imag(std::conj(psi) * grad[i]);
+}
+
+StreamlineTracer::StreamlineTracer() {
+    this->phi_c = 0;
+    this->theta_c = 0;
+    this->xmin = 0;
+    this->xmax = 0;
+    this->ymin = 0;
+    this->ymax = 0;
+    this->seeds_x = 12;
+    this->seeds_y = 12;
+    this->valid = false;
+    plane_basis(0, 0, unit_xp, unit_yp, unit_zp);
+}
+
+void StreamlineTracer::setStates(const std::vector<State> &states) {
+    bool same = states.size() == this->states.size()
+        && std::equal(states.begin(), states.end(), this->states.begin(),
+                [](const State &a, const State &b){
+                    return a.n == b.n && a.l == b.l && a.m == b.m && a.c == b.c;
+                });
+    if (same)
+        return;
+    this->states = states;
+    valid = false;
+}
+
+void StreamlineTracer::setView(double phi_c, double theta_c, double xmin, double xmax,
+                               double ymin, double ymax) {
+    if (phi_c == this->phi_c && theta_c == this->theta_c
+            && xmin == this->xmin && xmax == this->xmax
+            && ymin == this->ymin && ymax == this->ymax)
+        return;
+    this->phi_c = phi_c;
+    this->theta_c = theta_c;
+    this->xmin = xmin;
+    this->xmax = xmax;
+    this->ymin = ymin;
+    this->ymax = ymax;
+    plane_basis(phi_c, theta_c, unit_xp, unit_yp, unit_zp);
+    valid = false;
+}
+
+void StreamlineTracer::setSeeds(int seeds_x, int seeds_y) {
+    if (seeds_x == this->seeds_x && seeds_y == this->seeds_y)
+        return;
+    this->seeds_x = seeds_x;
+    this->seeds_y = seeds_y;
+    valid = false;
+}
+
+const std::vector<std::vector<double>> &StreamlineTracer::getLines() {
+    return lines;
+}
+
+// Unit direction of the in-plane current at count points of the plane.
+// Points where the current vanishes get a zero direction.
+void StreamlineTracer::fieldBatch(const double *xs, const double *ys, int count,
+                                  double *vx, double *vy) {
+    for (int i{0}; i < count; i++){
+        double p_coord[3] { xs[i], ys[i], 0 };
+        double car_coord[3];
+        convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
+        double j[3];
+        probability_current(states, car_coord, j);
+        double jx { j[0]*unit_xp[0] + j[1]*unit_xp[1] + j[2]*unit_xp[2] };
+        double jy { j[0]*unit_yp[0] + j[1]*unit_yp[1] + j[2]*unit_yp[2] };
+        double len { std::sqrt(jx*jx + jy*jy) };
+        vx[i] = len > 0 ? jx / len : 0;
+        vy[i] = len > 0 ? jy / len : 0;
+    }
+}
+
+// Traces the seeds with indices [first, last). Streamlines are followed by
+// arc length; each one stops when it leaves the view, reaches a zero of the
+// current, closes on itself or runs out of steps.
+void StreamlineTracer::traceRange(int first, int last, Arena &scratch) {
+    int count { last - first };
+    double extent { std::max(xmax - xmin, ymax - ymin) };
+    double tol { 1e-4 * extent };
+    double h_min { 1e-4 * extent };
+    double h_max { 0.02 * extent };
+
+    auto take = [&]{ return scratch.take<double>(count); };
+    double *px { take() }, *py { take() }, *h { take() }, *travelled { take() };
+    double *k1x { take() }, *k1y { take() };
+    int *active { scratch.take<int>(count) };
+    int na { count };
+    for (int s{0}; s < count; s++){
+        int seed { first + s };
+        px[s] = xmin + (xmax - xmin) * (seed / seeds_y + 0.5) / seeds_x;
+        py[s] = ymin + (ymax - ymin) * (seed % seeds_y + 0.5) / seeds_y;
+        h[s] = 0.005 * extent;
+        travelled[s] = 0;
+        // Cleared rather than reassigned, so that the lines keep room for
+        // the longest possible line
+        lines[seed].clear();
+        lines[seed].reserve(2 * (max_steps + 1));
+        lines[seed].push_back(px[s]);
+        lines[seed].push_back(py[s]);
+        active[s] = s;
+    }
+
+    // Scratch arrays for the batched stages, indexed by position in active
+    double *qx { take() }, *qy { take() }, *k2x { take() }, *k2y { take() },
+        *k3x { take() }, *k3y { take() }, *k4x { take() }, *k4y { take() },
+        *nx { take() }, *ny { take() };
+    fieldBatch(px, py, count, k1x, k1y);
+
+    for (int step{0}; step < max_steps && na > 0; step++){
+        for (int i{0}; i < na; i++){
+            int s { active[i] };
+            qx[i] = px[s] + h[s] / 2 * k1x[s];
+            qy[i] = py[s] + h[s] / 2 * k1y[s];
+        }
+        fieldBatch(qx, qy, na, k2x, k2y);
+        for (int i{0}; i < na; i++){
+            int s { active[i] };
+            qx[i] = px[s] + 3 * h[s] / 4 * k2x[i];
+            qy[i] = py[s] + 3 * h[s] / 4 * k2y[i];
+        }
+        fieldBatch(qx, qy, na, k3x, k3y);
+        for (int i{0}; i < na; i++){
+            int s { active[i] };
+            nx[i] = px[s] + h[s] * (2.0/9 * k1x[s] + 1.0/3 * k2x[i] + 4.0/9 * k3x[i]);
+            ny[i] = py[s] + h[s] * (2.0/9 * k1y[s] + 1.0/3 * k2y[i] + 4.0/9 * k3y[i]);
+        }
+        fieldBatch(nx, ny, na, k4x, k4y);
+
+        int kept{0};
+        for (int i{0}; i < na; i++){
+            int s { active[i] };
+            double ex { h[s] * (-5.0/72 * k1x[s] + 1.0/12 * k2x[i] + 1.0/9 * k3x[i] - 1.0/8 * k4x[i]) };
+            double ey { h[s] * (-5.0/72 * k1y[s] + 1.0/12 * k2y[i] + 1.0/9 * k3y[i] - 1.0/8 * k4y[i]) };
+            double err { std::sqrt(ex*ex + ey*ey) };
+            double factor { err > 0 ? 0.9 * std::cbrt(tol / err) : 2.0 };
+            factor = std::min(2.0, std::max(0.2, factor));
+            bool done{false};
+            if (err <= tol || h[s] <= h_min){
+                // Accept the step; the last stage is the first of the next (FSAL)
+                travelled[s] += h[s];
+                px[s] = nx[i];
+                py[s] = ny[i];
+                k1x[s] = k4x[i];
+                k1y[s] = k4y[i];
+                std::vector<double> &line = lines[first + s];
+                line.push_back(px[s]);
+                line.push_back(py[s]);
+
+                bool outside { px[s] < xmin || px[s] > xmax || py[s] < ymin || py[s] > ymax };
+                bool stalled { k1x[s] == 0 && k1y[s] == 0 };
+                double dx { px[s] - line[0] };
+                double dy { py[s] - line[1] };
+                bool closed { travelled[s] > 4 * h_max && std::sqrt(dx*dx + dy*dy) < h[s] };
+                done = outside || stalled || closed;
+            }
+            h[s] = std::min(h_max, std::max(h_min, h[s] * factor));
+            if (!done)
+                active[kept++] = s;
+        }
+        na = kept;
+    }
+}
+
+// Recomputes the streamlines if the states, view or seeds have changed.
+// The integrator's arrays are taken from scratch. Returns whether the
+// lines were recomputed.
+bool StreamlineTracer::trace(ScratchArenas &scratch) {
+    if (valid)
+        return false;
+    int total { seeds_x * seeds_y };
+    lines.resize(total);
+
+    // Chunks of seeds that are advanced together, so each chunk makes
+    // batched field queries and the chunks run on the pool
+    int chunks { std::min(total, 4 * ThreadPool::global().size()) };
+    ThreadPool::global().parallel_for(chunks, [&](int c){
+        Arena::Scope scope { scratch.local() };
+        traceRange(c * total / chunks, (c + 1) * total / chunks, scratch.local());
+    });
+
+    valid = true;
+    return true;
+}
@@ -0,0 +1,145 @@
+#include "../headers/decompose.h"
+
+inline const double pi = 3.141592653589793;
+
+CartesianGrid::CartesianGrid(int size, double half_width) {
+    this->size = size;
+    this->half_width = half_width;
+    this->data.assign((size_t)size * size * size, complexd_t{0});
+}
+
+complexd_t &CartesianGrid::at(int i, int j, int k) {
+    return data[((size_t)k * size + j) * size + i];
+}
+
+int CartesianGrid::getSize() {
+    return size;
+}
+
+double CartesianGrid::getHalfWidth() {
+    return half_width;
+}
+
+// Trilinear interpolation, zero outside the grid
+complexd_t CartesianGrid::sample(const double pos[3]) {
+    double step { 2 * half_width / (size - 1) };
+    int idx[3];
+    double frac[3];
+    for (int d{0}; d < 3; d++){
+        double u { (pos[d] + half_width) / step };
+        if (!(u >= 0 && u <= size - 1))
+            return 0;
+        idx[d] = std::min((int)u, size - 2);
+        frac[d] = u - idx[d];
+    }
+    complexd_t res{0};
+    for (int c{0}; c < 8; c++){
+        int di { c & 1 }, dj { (c >> 1) & 1 }, dk { (c >> 2) & 1 };
+        double w { (di ? frac[0] : 1 - frac[0])
+                 * (dj ? frac[1] : 1 - frac[1])
+                 * (dk ? frac[2] : 1 - frac[2]) };
+        res += w * at(idx[0] + di, idx[1] + dj, idx[2] + dk);
+    }
+    return res;
+}
+
+// Projects a field onto psi_nlm for n <= n_max.
+// Each radial shell r_i (Gauss-Legendre on [0, r_max]) is sampled on a
+// Gauss-Legendre x uniform grid in (cos theta, phi) and transformed to
+// a_lm(r_i) = <Ylm|f(r_i, .)> separably: a DFT along every ring of
+// constant theta, then a Legendre quadrature over the rings. Shells are
+// independent and run on the thread pool. Finally
+//   c_nlm = sum_i w_i r_i^2 Rnl(r_i) a_lm(r_i) / sum_i w_i r_i^2 Rnl(r_i)^2
+// where the denominator makes the result independent of how Rnl is
+// normalised. Coefficients below rel_cutoff times the largest are dropped.
+std::vector<State> decompose(const std::function<complexd_t(const double pos[3])> &field,
+                             int n_max, double r_max, int n_r, double rel_cutoff){
+    int l_max { n_max - 1 };
+    // Oversampled past the 2 l_max band limit of f Ylm* to tame aliasing
+    // from fields that are not band limited themselves
+    int n_theta { 2 * (l_max + 1) };
+    int n_phi { 4 * (l_max + 1) };
+    int n_lm { (l_max + 1) * (l_max + 1) };
+
+    std::vector<double> r, r_w, u, u_w;
+    gauss_legendre(n_r, 0, r_max, r, r_w);
+    gauss_legendre(n_theta, -1, 1, u, u_w);
+
+    // Normalised associated Legendre functions N_lm P_l^|m|(u_j), index (l*l + l + m) * n_theta + j
+    std::vector<double> legendre(n_lm * n_theta);
+    for (int l{0}; l <= l_max; l++)
+        for (int m{-l}; m <= l; m++)
+            for (int j{0}; j < n_theta; j++)
+                legendre[(l*l + l + m) * n_theta + j] =
+                    std::sqrt((2 * l + 1) / (4 * pi * fracfac(l, std::abs(m))))
+                    * std::assoc_legendre(l, std::abs(m), u[j]);
+
+    // a_lm for every shell, index i * n_lm + (l*l + l + m)
+    std::vector<complexd_t> alm((size_t)n_r * n_lm);
+
+    auto transform_shells = [&](int first, int last){
+        std::vector<complexd_t> ring(n_phi);
+        std::vector<complexd_t> fm((2 * l_max + 1) * n_theta);
+        for (int i{first}; i < last; i++){
+            for (int j{0}; j < n_theta; j++){
+                double sin_t { std::sqrt(1 - u[j] * u[j]) };
+                for (int k{0}; k < n_phi; k++){
+                    // phi is measured from +y towards +x as in spherical_from_cart
+                    double phi { 2 * pi * k / n_phi };
+                    double pos[3] { r[i] * sin_t * std::sin(phi), r[i] * sin_t * std::cos(phi), r[i] * u[j] };
+                    ring[k] = field(pos);
+                }
+                for (int m{-l_max}; m <= l_max; m++){
+                    complexd_t sum{0};
+                    for (int k{0}; k < n_phi; k++)
+                        sum += ring[k] * std::polar(1.0, -m * 2 * pi * k / n_phi);
+                    fm[(m + l_max) * n_theta + j] = sum * (2 * pi / n_phi);
+                }
+            }
+            for (int l{0}; l <= l_max; l++){
+                for (int m{-l}; m <= l; m++){
+                    complexd_t sum{0};
+                    const double *p { &legendre[(l*l + l + m) * n_theta] };
+                    for (int j{0}; j < n_theta; j++)
+                        sum += u_w[j] * p[j] * fm[(m + l_max) * n_theta + j];
+                    alm[(size_t)i * n_lm + l*l + l + m] = sum;
+                }
+            }
+        }
+    };
+
+    ThreadPool::global().parallel_for(n_r, [&](int i){
+        transform_shells(i, i + 1);
+    });
+
+    std::vector<State> states;
+    double largest{0};
+    for (int n{1}; n <= n_max; n++){
+        for (int l{0}; l < n; l++){
+            std::vector<double> radial(n_r);
+            double norm{0};
+            for (int i{0}; i < n_r; i++){
+                radial[i] = std::real(Rnl(n, l, r[i])) * r_w[i] * r[i] * r[i];
+                norm += radial[i] * std::real(Rnl(n, l, r[i]));
+            }
+            for (int m{-l}; m <= l; m++){
+                complexd_t c{0};
+                for (int i{0}; i < n_r; i++)
+                    c += radial[i] * alm[(size_t)i * n_lm + l*l + l + m];
+                c /= norm;
+                states.push_back({n, l, m, c});
+                largest = std::max(largest, std::abs(c));
+            }
+        }
+    }
+    states.erase(std::remove_if(states.begin(), states.end(),
+                [&](const State &s){ return std::abs(s.c) <= rel_cutoff * largest; }),
+            states.end());
+    return states;
+}
+
+// Decomposes a sampled grid over the largest ball that fits inside it
+std::vector<State> decompose(CartesianGrid &grid, int n_max, int n_r, double rel_cutoff){
+    return decompose([&](const double pos[3]){ return grid.sample(pos); },
+            n_max, grid.getHalfWidth(), n_r, rel_cutoff);
+}
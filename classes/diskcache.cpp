@@ -0,0 +1,341 @@
+#include "../headers/diskcache.h"
+#include "../headers/threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <ctime>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Version of the code that computed a cached result, written by the
+// Makefile; results of other builds are never read
+#if __has_include("code_version.h")
+#include "code_version.h"
+#endif
+#ifndef CODE_VERSION
+#define CODE_VERSION "unversioned"
+#endif
+
+// Bumped when the file layout changes
+static const uint32_t format_version = 1;
+static const char magic[8] = { 'H', 'Y', 'D', 'C', 'A', 'C', 'H', 'E' };
+
+// Fixed part of every file, followed by the key bytes and the payload
+struct FileHeader
+{
+    char magic[8];
+    uint32_t format;
+    uint32_t key_bytes;
+    uint64_t payload_bytes;
+    uint64_t checksum;
+};
+
+uint64_t fnv1a(const void *data, size_t bytes, uint64_t hash){
+    const unsigned char *p { static_cast<const unsigned char *>(data) };
+    for (size_t i{0}; i < bytes; i++){
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+CacheKey::CacheKey(const char *kind) {
+    this->used = 0;
+    add(CODE_VERSION);
+    add(kind);
+}
+
+void CacheKey::append(const void *value, size_t bytes) {
+    if (used + bytes > capacity)
+        throw std::length_error("CacheKey: key too long");
+    std::memcpy(data + used, value, bytes);
+    used += bytes;
+}
+
+CacheKey &CacheKey::add(int value) {
+    append(&value, sizeof(value));
+    return *this;
+}
+
+CacheKey &CacheKey::add(double value) {
+    append(&value, sizeof(value));
+    return *this;
+}
+
+// Including the terminating zero, so that "ab", "c" and "a", "bc" differ
+CacheKey &CacheKey::add(const char *value) {
+    append(value, std::strlen(value) + 1);
+    return *this;
+}
+
+const char *CacheKey::bytes() const {
+    return data;
+}
+
+size_t CacheKey::size() const {
+    return used;
+}
+
+uint64_t CacheKey::hash() const {
+    return fnv1a(data, used);
+}
+
+static bool make_dirs(const std::string &dir){
+    for (size_t i{1}; i <= dir.size(); i++){
+        if (i < dir.size() && dir[i] != '/')
+            continue;
+        std::string part { dir.substr(0, i) };
+        if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+DiskCache::DiskCache(const std::string &dir, size_t capacity_bytes) {
+    this->dir = dir;
+    this->ready = !dir.empty() && make_dirs(dir);
+    this->capacity = capacity_bytes;
+    this->unchecked = 0;
+    this->trimmed = false;
+    this->pending_bytes = 0;
+    this->writing = false;
+    this->stop = false;
+}
+
+// Pending writes are finished first
+DiskCache::~DiskCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    if (writer.joinable())
+        writer.join();
+}
+
+DiskCache &DiskCache::global() {
+    static DiskCache cache { [](){
+        if (const char *own = std::getenv("HYDROGEN_CACHE_DIR"))
+            return std::string(own);
+        if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+            return std::string(xdg) + "/hydrogen";
+        if (const char *home = std::getenv("HOME"); home && *home)
+            return std::string(home) + "/.cache/hydrogen";
+        return std::string();
+    }(), [](){
+        if (const char *mb = std::getenv("HYDROGEN_CACHE_MB"); mb && *mb)
+            return (size_t)std::strtoull(mb, nullptr, 10) << 20;
+        return default_capacity;
+    }() };
+    return cache;
+}
+
+bool DiskCache::enabled() {
+    return ready;
+}
+
+void DiskCache::path(const CacheKey &key, char *out, size_t size) {
+    std::snprintf(out, size, "%s/%016llx.bin", dir.c_str(), (unsigned long long)key.hash());
+}
+
+// Fills data with the bytes stored under key and returns true, or
+// returns false if there are none of exactly that size
+bool DiskCache::load(const CacheKey &key, void *data, size_t bytes) {
+    if (!ready)
+        return false;
+    char file[PATH_MAX];
+    path(key, file, sizeof(file));
+    int fd { open(file, O_RDONLY) };
+    if (fd < 0)
+        return false;
+    struct stat info;
+    size_t expected { sizeof(FileHeader) + key.size() + bytes };
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size != expected){
+        close(fd);
+        return false;
+    }
+    void *map { mmap(nullptr, expected, PROT_READ, MAP_PRIVATE, fd, 0) };
+    if (map == MAP_FAILED){
+        close(fd);
+        return false;
+    }
+
+    const char *base { static_cast<const char *>(map) };
+    FileHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    const char *stored_key { base + sizeof(header) };
+    const char *payload { stored_key + key.size() };
+    bool same_key { std::memcmp(header.magic, magic, sizeof(magic)) == 0
+        && header.format == format_version
+        && header.key_bytes == key.size()
+        && header.payload_bytes == bytes
+        && std::memcmp(stored_key, key.bytes(), key.size()) == 0 };
+    bool intact { same_key && fnv1a(payload, bytes) == header.checksum };
+    // The modification time orders the files for trim(), so a hit
+    // makes the file the most recently used
+    if (intact){
+        std::memcpy(data, payload, bytes);
+        futimens(fd, nullptr);
+    }
+    munmap(map, expected);
+    close(fd);
+    // Same name but a different key is a collision and left alone;
+    // a damaged file would fail every time
+    if (same_key && !intact)
+        unlink(file);
+    return intact;
+}
+
+bool DiskCache::store(const CacheKey &key, const void *data, size_t bytes) {
+    if (!ready)
+        return false;
+    FileHeader header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.format = format_version;
+    header.key_bytes = (uint32_t)key.size();
+    header.payload_bytes = bytes;
+    header.checksum = fnv1a(data, bytes);
+
+    // Readers never see a partly written file. The temporary name is
+    // unique to this write, two threads may store the same key.
+    static std::atomic<unsigned> writes {0};
+    char file[PATH_MAX];
+    path(key, file, sizeof(file));
+    std::string temp { std::string(file) + ".tmp" + std::to_string(getpid()) + "." + std::to_string(writes++) };
+    FILE *out { std::fopen(temp.c_str(), "wb") };
+    if (!out)
+        return false;
+    bool written { std::fwrite(&header, sizeof(header), 1, out) == 1
+        && std::fwrite(key.bytes(), 1, key.size(), out) == key.size()
+        && std::fwrite(data, 1, bytes, out) == bytes };
+    written = std::fclose(out) == 0 && written;
+    if (!written || std::rename(temp.c_str(), file) != 0){
+        std::remove(temp.c_str());
+        return false;
+    }
+
+    // Trimming scans the directory, so only once a sixteenth of the cap
+    // has been added since the last time
+    bool due;
+    {
+        std::lock_guard<std::mutex> lock(trimming);
+        unchecked += sizeof(header) + key.size() + bytes;
+        due = !trimmed || unchecked > capacity / 16;
+    }
+    if (due)
+        trim();
+    return true;
+}
+
+// Copies the data, so the caller may change it right away. Nothing more
+// is taken while a sixteenth of the cap is waiting to be written.
+void DiskCache::storeLater(const CacheKey &key, const void *data, size_t bytes) {
+    if (!ready)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!pending.empty() && pending_bytes + bytes > capacity / 16)
+            return;
+        std::vector<char> copy;
+        if (!spare.empty()){
+            copy.swap(spare.back());
+            spare.pop_back();
+        }
+        const char *from { static_cast<const char *>(data) };
+        copy.assign(from, from + bytes);
+        pending.push_back({ key, std::move(copy) });
+        pending_bytes += bytes;
+        if (!writer.joinable())
+            writer = std::thread(&DiskCache::write, this);
+    }
+    wake.notify_all();
+}
+
+void DiskCache::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    written.wait(lock, [&]{ return pending.empty() && !writing; });
+}
+
+// Deletes the least recently used files until the directory fits in the
+// cap, and temporary files older than an hour, which no writer is going
+// to rename any more
+void DiskCache::trim() {
+    if (!ready)
+        return;
+    std::lock_guard<std::mutex> lock(trimming);
+    DIR *listing { opendir(dir.c_str()) };
+    if (!listing)
+        return;
+    struct File
+    {
+        std::string name;
+        time_t used;
+        size_t bytes;
+    };
+    std::vector<File> files;
+    size_t total { 0 };
+    time_t now { std::time(nullptr) };
+    while (dirent *entry = readdir(listing)){
+        std::string name { entry->d_name };
+        bool temp { name.find(".bin.tmp") != std::string::npos };
+        bool cached { name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0 };
+        if (!temp && !cached)
+            continue;
+        std::string full { dir + "/" + name };
+        struct stat info;
+        if (stat(full.c_str(), &info) != 0)
+            continue;
+        if (temp){
+            if (now - info.st_mtime > 3600)
+                unlink(full.c_str());
+            continue;
+        }
+        files.push_back({ full, info.st_mtime, (size_t)info.st_size });
+        total += (size_t)info.st_size;
+    }
+    closedir(listing);
+
+    std::sort(files.begin(), files.end(), [](const File &a, const File &b){
+        return a.used < b.used;
+    });
+    for (const File &file : files){
+        if (total <= capacity)
+            break;
+        if (unlink(file.name.c_str()) == 0)
+            total -= file.bytes;
+    }
+    unchecked = 0;
+    trimmed = true;
+}
+
+void DiskCache::write() {
+    ThreadPool::lower_priority();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true){
+        wake.wait(lock, [&]{ return stop || !pending.empty(); });
+        if (pending.empty())
+            return;
+        Pending next { std::move(pending.front()) };
+        pending.erase(pending.begin());
+        writing = true;
+        lock.unlock();
+        store(next.key, next.data.data(), next.data.size());
+        lock.lock();
+        writing = false;
+        pending_bytes -= next.data.size();
+        if (spare.size() < 4)
+            spare.push_back(std::move(next.data));
+        if (pending.empty())
+            written.notify_all();
+    }
+}
@@ -0,0 +1,273 @@
+#include "../headers/fft.h"
+
+inline const double pi = 3.141592653589793;
+
+// Number of lines gathered together for the strided axes, so that each
+// read of the volume touches whole cache lines
+static const int block_lines = 8;
+
+// Complex product without the inf/nan handling of operator*
+static inline complexd_t cmul(complexd_t a, complexd_t b){
+    return { a.real() * b.real() - a.imag() * b.imag(),
+             a.real() * b.imag() + a.imag() * b.real() };
+}
+
+FFTPlan::FFTPlan(int n, int sign) {
+    if (!supported(n))
+        throw std::invalid_argument("FFT length must be a product of 2, 3 and 5");
+    this->n = n;
+    this->sign = sign;
+
+    int rest = n;
+    for (int r : {5, 3, 2})
+        while (rest % r == 0){
+            radices.push_back(r);
+            rest /= r;
+        }
+
+    // Twiddles exp(sign 2 pi i k r / (ns R)) for every stage, k < ns, r < R
+    int ns = 1;
+    for (int r : radices){
+        for (int k{0}; k < ns; k++)
+            for (int q{0}; q < r; q++)
+                twiddles.push_back(std::polar(1.0, sign * 2 * pi * k * q / (ns * r)));
+        ns *= r;
+    }
+    for (int q{0}; q < 3; q++)
+        roots3.push_back(std::polar(1.0, sign * 2 * pi * q / 3));
+    for (int q{0}; q < 5; q++)
+        roots5.push_back(std::polar(1.0, sign * 2 * pi * q / 5));
+}
+
+bool FFTPlan::supported(int n) {
+    if (n < 1)
+        return false;
+    for (int r : {2, 3, 5})
+        while (n % r == 0)
+            n /= r;
+    return n == 1;
+}
+
+int FFTPlan::size() {
+    return n;
+}
+
+// Unnormalised transform of data in place; scratch must hold n values.
+// Stockham autosort: stage s reads x and writes y with no bit reversal,
+// combining R sub-transforms of length ns into transforms of length ns R.
+void FFTPlan::execute(complexd_t *data, complexd_t *scratch) const {
+    complexd_t *x {data};
+    complexd_t *y {scratch};
+    const complexd_t *tw {twiddles.data()};
+    int ns = 1;
+    for (int r : radices){
+        int stride { n / r };
+        // j = group * ns + k runs over the first input of every butterfly
+        for (int group{0}; group < stride / ns; group++){
+            for (int k{0}; k < ns; k++){
+                int j { group * ns + k };
+                const complexd_t *w { tw + k * r };
+                complexd_t v[5];
+                v[0] = x[j];
+                for (int q{1}; q < r; q++)
+                    v[q] = cmul(x[j + q * stride], w[q]);
+
+                complexd_t out[5];
+                if (r == 2){
+                    out[0] = v[0] + v[1];
+                    out[1] = v[0] - v[1];
+                }
+                else {
+                    const complexd_t *root { r == 3 ? roots3.data() : roots5.data() };
+                    for (int p{0}; p < r; p++){
+                        complexd_t sum {v[0]};
+                        for (int q{1}; q < r; q++)
+                            sum += cmul(v[q], root[(p * q) % r]);
+                        out[p] = sum;
+                    }
+                }
+
+                int base { group * ns * r + k };
+                for (int q{0}; q < r; q++)
+                    y[base + q * ns] = out[q];
+            }
+        }
+        tw += ns * r;
+        ns *= r;
+        std::swap(x, y);
+    }
+    if (x != data)
+        std::copy(x, x + n, data);
+}
+
+// Runs body(first, last) over [0, count) in a few chunks per pool thread
+template <typename F>
+static void parallel_chunks(int count, F body){
+    int chunks { std::max(1, std::min(count, 4 * ThreadPool::global().size())) };
+    ThreadPool::global().parallel_for(chunks, [&](int c){
+        body(c * count / chunks, (c + 1) * count / chunks);
+    });
+}
+
+// Transforms every line along an axis of stride `stride` (in elements).
+// Lines are identified by their first element; `first_of(i)` gives the
+// offset of line i. Consecutive lines are block_lines apart by one
+// element, so gathering a block reads contiguous memory.
+template <typename F>
+static void transform_axis(complexd_t *data, const FFTPlan &plan, int len, int stride,
+                           int lines, F first_of){
+    parallel_chunks(lines / block_lines + (lines % block_lines != 0), [&](int first, int last){
+        std::vector<complexd_t> block((size_t)len * block_lines);
+        std::vector<complexd_t> scratch(len);
+        for (int b{first}; b < last; b++){
+            int l0 { b * block_lines };
+            int count { std::min(block_lines, lines - l0) };
+            // Gather: a transpose of a len x count tile into count contiguous lines
+            for (int i{0}; i < len; i++)
+                for (int c{0}; c < count; c++)
+                    block[(size_t)c * len + i] = data[first_of(l0 + c) + (size_t)i * stride];
+            for (int c{0}; c < count; c++)
+                plan.execute(&block[(size_t)c * len], scratch.data());
+            for (int i{0}; i < len; i++)
+                for (int c{0}; c < count; c++)
+                    data[first_of(l0 + c) + (size_t)i * stride] = block[(size_t)c * len + i];
+        }
+    });
+}
+
+// In place unnormalised 3D transform of data[(k * ny + j) * nx + i]
+void fft3d(complexd_t *data, int nx, int ny, int nz, int sign){
+    FFTPlan px(nx, sign), py(ny, sign), pz(nz, sign);
+
+    // x lines are contiguous
+    parallel_chunks(ny * nz, [&](int first, int last){
+        std::vector<complexd_t> scratch(nx);
+        for (int line{first}; line < last; line++)
+            px.execute(data + (size_t)line * nx, scratch.data());
+    });
+    // y lines: for each plane z, the x index selects the line
+    transform_axis(data, py, ny, nx, nx * nz, [&](int line){
+        return (size_t)(line / nx) * nx * ny + line % nx;
+    });
+    // z lines: one per (x, y)
+    transform_axis(data, pz, nz, nx * ny, nx * ny, [&](int line){
+        return (size_t)line;
+    });
+}
+
+// Real to complex forward transform of in[(k * ny + j) * nx + i] with nx
+// even. out holds the non-redundant half, out[(k * ny + j) * (nx/2+1) + i].
+// Along x, pairs of reals are packed into one complex line of length nx/2
+// whose transform is then split into the spectrum of the real line.
+void rfft3d(const double *in, complexd_t *out, int nx, int ny, int nz){
+    if (nx % 2 != 0)
+        throw std::invalid_argument("rfft3d needs an even nx");
+    int h { nx / 2 };
+    int nh { h + 1 };
+    FFTPlan px(h, -1), py(ny, -1), pz(nz, -1);
+    std::vector<complexd_t> split(h);
+    for (int k{0}; k < h; k++)
+        split[k] = std::polar(1.0, -2 * pi * k / nx);
+
+    parallel_chunks(ny * nz, [&](int first, int last){
+        std::vector<complexd_t> z(h), scratch(h);
+        for (int line{first}; line < last; line++){
+            const double *src { in + (size_t)line * nx };
+            complexd_t *dst { out + (size_t)line * nh };
+            for (int k{0}; k < h; k++)
+                z[k] = { src[2 * k], src[2 * k + 1] };
+            px.execute(z.data(), scratch.data());
+            for (int k{0}; k < h; k++){
+                complexd_t a { z[k] };
+                complexd_t b { std::conj(z[(h - k) % h]) };
+                complexd_t even { (a + b) * 0.5 };
+                complexd_t odd { (a - b) * complexd_t(0, -0.5) };
+                dst[k] = even + cmul(split[k], odd);
+            }
+            dst[h] = z[0].real() - z[0].imag();
+        }
+    });
+    transform_axis(out, py, ny, nh, nh * nz, [&](int line){
+        return (size_t)(line / nh) * nh * ny + line % nh;
+    });
+    transform_axis(out, pz, nz, nh * ny, nh * ny, [&](int line){
+        return (size_t)line;
+    });
+}
+
+// psi_nlm on a size^3 Cartesian grid spanning [-half_width, half_width)
+// along every axis, endpoint exclusive like linspace, index (k * size + j) * size + i
+complexd_t *get_volume(int n, int l, int m, double half_width, int size){
+    size_t total { (size_t)size * size * size };
+    complexd_t *vol { new complexd_t[total] };
+    CacheKey key { "volume" };
+    key.add(n).add(l).add(m).add(half_width).add(size);
+    if (DiskCache::global().load(key, vol, total * sizeof(complexd_t)))
+        return vol;
+    std::vector<double> axis(size);
+    linspace(-half_width, half_width, size, axis.data());
+    // Only one octant is evaluated, see symmetry.h
+    parallel_chunks(size, [&](int first, int last){
+        for (int k{first}; k < last; k++){
+            if (!fundamental(k, size))
+                continue;
+            for (int j{0}; j < size; j++){
+                if (!fundamental(j, size))
+                    continue;
+                for (int i{0}; i < size; i++){
+                    if (!fundamental(i, size))
+                        continue;
+                    double cart[3] { axis[i], axis[j], axis[k] };
+                    double sph[3];
+                    spherical_from_cart(cart, sph);
+                    vol[((size_t)k * size + j) * size + i] = psi_nlm(n, l, m, sph[0], sph[1], sph[2]);
+                }
+            }
+        }
+    });
+    fill_volume_symmetry(vol, l, m, size);
+    DiskCache::global().store(key, vol, total * sizeof(complexd_t));
+    return vol;
+}
+
+// |phi(p)|^2 on the momentum grid of get_volume, with p = 0 moved to
+// the centre of the volume. Normalised to unit sum over the grid.
+double *momentum_density(int n, int l, int m, double half_width, int size){
+    complexd_t *vol { get_volume(n, l, m, half_width, size) };
+    fft3d(vol, size, size, size, -1);
+    size_t total { (size_t)size * size * size };
+    double *density { new double[total] };
+    double sum{0};
+    int h { size / 2 };
+    for (int k{0}; k < size; k++)
+        for (int j{0}; j < size; j++)
+            for (int i{0}; i < size; i++){
+                double d { std::norm(vol[((size_t)k * size + j) * size + i]) };
+                density[(((size_t)(k + h) % size) * size + (j + h) % size) * size + (i + h) % size] = d;
+                sum += d;
+            }
+    for (size_t i{0}; i < total; i++)
+        density[i] /= sum;
+    delete[] vol;
+    return density;
+}
+
+// Times forward transforms of a size^3 volume of a 4f orbital and prints
+// the throughput in GFLOP/s using the conventional 5 N log2 N flop count
+double fft_benchmark(int size, int repeats){
+    complexd_t *vol { get_volume(4, 3, 1, 40 * a0, size) };
+    std::vector<complexd_t> work(vol, vol + (size_t)size * size * size);
+    double total { (double)size * size * size };
+    double flops { 5 * total * std::log2(total) * repeats };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r{0}; r < repeats; r++)
+        fft3d(work.data(), size, size, size, -1);
+    double seconds { std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+    delete[] vol;
+
+    double gflops { flops / seconds * 1e-9 };
+    std::cout << "fft3d " << size << "^3: " << seconds / repeats * 1e3 << " ms, "
+              << gflops << " GFLOP/s" << std::endl;
+    return gflops;
+}
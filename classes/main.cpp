@@ -14,14 +14,26 @@
 #include <iostream>
 #include <math.h>
 #include <map>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cassert>
+#include <cstdlib>
 
 /* Other project files */
 #include "../headers/shader.h"
 #include "../headers/plane.h"
 #include "../headers/wavefunction.h"
+#include "../headers/fft.h"
+#include "../headers/threadpool.h"
+#include "../headers/allocations.h"
+#include "../headers/resolution.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow *window);
+void benchThreads();
+void checkAllocations();
+void checkKernels();
 
 // settings
 const unsigned int SCR_WIDTH = 800;
@@ -41,8 +53,30 @@ struct Character {
 
 std::map<GLchar, Character> Characters;
 
-int main()
+int main(int argc, char *argv[])
 {
+    // Benchmarks run headless and exit. They turn the disk cache off, so
+    // that they measure the computation and leave the user's cache alone.
+    if (argc > 1 && std::string(argv[1]).rfind("--", 0) == 0)
+        setenv("HYDROGEN_CACHE_DIR", "", 1);
+    if (argc > 1 && std::string(argv[1]) == "--bench-fft") {
+        for (int size : {32, 60, 64, 120, 128})
+            fft_benchmark(size, 3);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-threads") {
+        benchThreads();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--check-allocations") {
+        checkAllocations();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--check-kernels") {
+        checkKernels();
+        return 0;
+    }
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -245,7 +279,7 @@ int main()
 
     std::cout << "Size of vertices: "<< plane1.verticesSize() << "\nSize of indices: " << plane1.indicesSize() << std::endl;
     glBindBuffer(GL_ARRAY_BUFFER, pVBO);
-    glBufferData(GL_ARRAY_BUFFER, plane1.verticesSize(), plane_vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, plane1.verticesSize(), plane_vertices, GL_DYNAMIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pEBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, plane1.indicesSize(), plane_indices, GL_STATIC_DRAW);
@@ -266,6 +300,24 @@ int main()
     // VAOs requires a call to glBindVertexArray anyways so we generally don't unbind VAOs (nor VBOs) when it's not directly necessary.
     glBindVertexArray(0); 
 
+    // Samples per side of the plane, so that computing and uploading an
+    // image takes about 12 ms, and never fewer than 50
+    ResolutionController resolution(150, 50, 400, 12.0);
+
+
+    // Probability current streamlines drawn on top of the plane
+    unsigned int sVBO, sVAO;
+    glGenVertexArrays(1, &sVAO);
+    glGenBuffers(1, &sVBO);
+    glBindVertexArray(sVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, sVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3*sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
 
     // VAOSTUFF for textrendering
     unsigned int textVAO, textVBO;
@@ -312,6 +364,11 @@ int main()
     bool nWasPressed = false;
     bool lWasPressed = false;
     bool mWasPressed = false;
+    bool tabWasPressed = false;
+    bool jWasPressed = false;
+    bool rWasPressed = false;
+    bool gWasPressed = false;
+    bool tWasPressed = false;
     while (!glfwWindowShouldClose(window))
     {
         // input
@@ -362,6 +419,41 @@ int main()
         if (mWasPressed && glfwGetKey(window, GLFW_KEY_M) == GLFW_RELEASE) {
             mWasPressed = false;
         }
+        if (!tabWasPressed && glfwGetKey(window, GLFW_KEY_TAB) == GLFW_PRESS) {
+            plane1.cycleMode();
+            tabWasPressed = true;
+        }
+        if (tabWasPressed && glfwGetKey(window, GLFW_KEY_TAB) == GLFW_RELEASE) {
+            tabWasPressed = false;
+        }
+        if (!jWasPressed && glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS) {
+            plane1.toggleCurrent();
+            jWasPressed = true;
+        }
+        if (jWasPressed && glfwGetKey(window, GLFW_KEY_J) == GLFW_RELEASE) {
+            jWasPressed = false;
+        }
+        if (!rWasPressed && glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
+            plane1.toggleAmortised();
+            rWasPressed = true;
+        }
+        if (rWasPressed && glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE) {
+            rWasPressed = false;
+        }
+        if (!gWasPressed && glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
+            plane1.toggleLogScale();
+            gWasPressed = true;
+        }
+        if (gWasPressed && glfwGetKey(window, GLFW_KEY_G) == GLFW_RELEASE) {
+            gWasPressed = false;
+        }
+        if (!tWasPressed && glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS) {
+            plane1.toggleTiled();
+            tWasPressed = true;
+        }
+        if (tWasPressed && glfwGetKey(window, GLFW_KEY_T) == GLFW_RELEASE) {
+            tWasPressed = false;
+        }
         if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
             plane1.zoomIn();
         }
@@ -374,14 +466,56 @@ int main()
         if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
             plane1.decSensitivity();
         }
+        // Moving the view shows previews until the keys have been let go.
+        // LEFT and RIGHT only change the sensitivity, which the shader
+        // applies to the image as it is.
+        plane1.setInteracting(glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS
+                              || glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS
+                              || glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS
+                              || glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS
+                              || glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS
+                              || glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS);
 
 
         // update state
         nmltext = "n=" + std::to_string(plane1.getn()) + ", l=" + std::to_string(plane1.getl()) + ", m=" + std::to_string(plane1.getm());
-        plane1.updateColors(theta,phi);
-        plane_vertices = plane1.getVertices();
-        glBindBuffer(GL_ARRAY_BUFFER, pVBO);
-        glBufferData(GL_ARRAY_BUFFER, plane1.verticesSize(), plane_vertices, GL_STATIC_DRAW);
+        if (plane1.getMode() != Plane::Mode::Slice)
+            nmltext += ", " + plane1.modeName();
+        else if (plane1.isAmortised())
+            nmltext += ", amortised";
+        else if (plane1.isTiled())
+            nmltext += ", tiled";
+        if (plane1.logScale())
+            nmltext += ", log";
+        nmltext += ", " + std::to_string(plane1.getTileW()) + "x" + std::to_string(plane1.getTileH());
+        if (plane1.showsPreview())
+            nmltext += ", preview";
+        // Time in atomic units, sped up so that the n=1,2 beat takes ~3s
+        double t = 5.0 * glfwGetTime();
+        // Only upload when the colours changed, and time the frames that do
+        auto computeStart = std::chrono::steady_clock::now();
+        if (plane1.updateColors(theta, phi, t)) {
+            plane_vertices = plane1.getVertices();
+            glBindBuffer(GL_ARRAY_BUFFER, pVBO);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, plane1.verticesSize(), plane_vertices);
+            double computeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - computeStart).count();
+            // A new size has new vertices and indices, so both buffers are
+            // replaced; the next frame renders at it. Previews are cheaper
+            // by design, and images copied from a cache cost next to
+            // nothing, so neither says anything about the rendered frames.
+            if (plane1.rendered() && resolution.record(computeMs)) {
+                plane1.setResolution(resolution.size(), resolution.size());
+                glBindVertexArray(pVAO);
+                glBindBuffer(GL_ARRAY_BUFFER, pVBO);
+                glBufferData(GL_ARRAY_BUFFER, plane1.verticesSize(), plane1.getVertices(), GL_DYNAMIC_DRAW);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, plane1.indicesSize(), plane1.getIndices(), GL_STATIC_DRAW);
+                glBindVertexArray(0);
+            }
+        }
+        if (plane1.showsCurrent() && plane1.updateStreamlines(theta, phi, t)) {
+            glBindBuffer(GL_ARRAY_BUFFER, sVBO);
+            glBufferData(GL_ARRAY_BUFFER, plane1.streamlinesSize(), plane1.getStreamlines(), GL_DYNAMIC_DRAW);
+        }
 
         // render
         // ------
@@ -397,11 +531,21 @@ int main()
         greenValue = (sin(timeValue));
         mainShader.setFloat("alpha", 1.0);
         mainShader.setMat4("transform", trans);
+        // Sensitivity and scaling of the slice are applied in the shader
+        mainShader.setBool("complexColors", true);
+        mainShader.setFloat("normalization", plane1.getNormalization());
+        mainShader.setBool("logScale", plane1.logScale());
 
 
         glBindVertexArray(pVAO); 
         glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         glDrawElements(GL_TRIANGLES, plane1.indicesSize() / sizeof(unsigned int), GL_UNSIGNED_INT, 0);
+        mainShader.setBool("complexColors", false);
+
+        if (plane1.showsCurrent()) {
+            glBindVertexArray(sVAO);
+            glDrawArrays(GL_LINES, 0, plane1.streamlinesSize() / (6 * sizeof(float)));
+        }
 
         glBindVertexArray(ipVAO); 
         tmpTrans = glm::rotate(axesTrans, (float) theta, glm::vec3(0.0, 0.0, 1.0));
@@ -432,7 +576,10 @@ int main()
         currentTime = glfwGetTime();
         frameDiff++;
         if ( currentTime - lastTime >= 1.0 ) {
-            printf("%f ms\n", 1000.0/((double)(frameDiff)));
+            SliceCache::Stats cache = plane1.cacheStats();
+            printf("%f ms, %dx%d samples at %.1f ms, slice cache %lu hits %lu misses, %zu images in %.1f MB\n",
+                   1000.0/((double)(frameDiff)), plane1.getTileW(), plane1.getTileH(), resolution.average(),
+                   cache.hits, cache.misses, cache.entries, cache.bytes / 1048576.0);
             frameDiff = 0;
             lastTime += 1.0;
         }
@@ -450,6 +597,224 @@ int main()
     return 0;
 }
 
+// Times get_colors on the default 150x150 plane for 1 to N pool threads,
+// and checks that every thread count gives bitwise the same image
+void benchThreads()
+{
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    int size = 150 * 150 * 4;
+    double* reference = nullptr;
+    double single = 0;
+    for (int threads = 1; threads <= max_threads; threads++) {
+        ThreadPool::global().resize(threads);
+        auto start = std::chrono::steady_clock::now();
+        double* colors = get_colors(4, 3, 1, 0.3, 0.8, -3e-9, 3e-9, -3e-9, 3e-9, 150, 150);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (threads == 1) {
+            reference = colors;
+            single = ms;
+        }
+        bool identical = std::memcmp(colors, reference, size * sizeof(double)) == 0;
+        printf("%2d threads: %8.2f ms, speedup %5.2f, %s\n", threads, ms, single / ms,
+               identical ? "identical" : "DIFFERENT");
+        if (colors != reference)
+            delete[] colors;
+    }
+    delete[] reference;
+}
+
+// Drives a plane through the interactions of the main loop and asserts
+// that, once the buffers have reached their working size, frames do not
+// allocate. Needs a build with -DCOUNT_ALLOCATIONS (make allocations).
+void checkAllocations()
+{
+    if (!counting_allocations()) {
+        printf("not counting allocations, build with -DCOUNT_ALLOCATIONS\n");
+        return;
+    }
+    Plane plane(0.7f, 0.7f, 150, 150);
+    for (int i = 0; i < 3; i++)
+        plane.increment_n();
+    for (int i = 0; i < 3; i++)
+        plane.increment_l();
+    plane.increment_m();
+    plane.toggleCurrent();
+    double theta = 0.3, phi = 0.8, t = 0;
+
+    // The first half of the frames may still grow buffers
+    auto frames = [&](const char *name, auto step) {
+        const int count = 20;
+        unsigned long steady = 0;
+        for (int i = 0; i < count; i++) {
+            step();
+            unsigned long before = allocation_count();
+            plane.updateColors(theta, phi, t);
+            plane.updateStreamlines(theta, phi, t);
+            if (i >= count / 2)
+                steady += allocation_count() - before;
+        }
+        printf("%-14s %-7s %5.1f allocations per frame\n", plane.modeName().c_str(), name,
+               (double)steady / (count - count / 2));
+        assert(steady == 0);
+    };
+    auto turn = [&] { theta += 0.01; phi += 0.007; };
+    auto zoom = [&] { plane.zoomIn(); };
+    auto evolve = [&] { t += 0.1; };
+
+    frames("turn", turn);
+    frames("zoom", zoom);
+    plane.toggleAmortised();
+    frames("turn", turn);
+    plane.toggleAmortised();
+    for (int mode = 1; mode < 4; mode++) {
+        plane.cycleMode();
+        frames("turn", turn);
+        frames("zoom", zoom);
+        frames("evolve", evolve);
+    }
+    // Previews, while a key that moves the view is held
+    auto held = [&] { plane.setInteracting(true); turn(); };
+    for (int mode = 0; mode < 4; mode++) {
+        plane.cycleMode();
+        frames("preview", held);
+    }
+}
+
+// Largest difference to the reference, relative to its largest value.
+// Points where the reference is not finite, the nucleus, are left out.
+static double relative_error(const complexd_t *value, const complexd_t *reference, size_t size)
+{
+    double difference = 0, largest = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (!std::isfinite(std::abs(reference[i])))
+            continue;
+        difference = std::max(difference, std::abs(value[i] - reference[i]));
+        largest = std::max(largest, std::abs(reference[i]));
+    }
+    return largest > 0 ? difference / largest : difference;
+}
+
+// Compares the optimised kernels with direct evaluation, on odd and even
+// sizes, since the symmetry fills and the FFT factorisations differ
+// between them: get_psi, get_volume and RotatedSlice against psi_nlm,
+// fft3d against a naive DFT and rfft3d against fft3d (make kernels)
+void checkKernels()
+{
+    const double tolerance = 1e-9;
+    struct Orbital { int n, l, m; };
+    auto report = [&](const char *kernel, const Orbital &o, int size, double error) {
+        printf("%-12s %d %d %2d  size %3d  relative error %.1e\n", kernel, o.n, o.l, o.m, size, error);
+        assert(error < tolerance);
+    };
+    // psi_nlm on a slice, pixel by pixel in get_psi's order
+    auto direct_slice = [](const Orbital &o, double phi_c, double theta_c, double xmin, double xmax,
+                           double ymin, double ymax, int n_x, int n_y, complexd_t *psi) {
+        double unit_xp[3], unit_yp[3], unit_zp[3];
+        plane_basis(phi_c, theta_c, unit_xp, unit_yp, unit_zp);
+        double deltax = (xmax - xmin) / n_x, deltay = (ymax - ymin) / n_y;
+        for (int ix = 0; ix < n_x; ix++)
+            for (int iy = 0; iy < n_y; iy++) {
+                double p_coord[3] = { xmin + deltax * ix, ymin + deltay * iy, 0 };
+                double car_coord[3], sph_coord[3];
+                convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
+                spherical_from_cart(car_coord, sph_coord);
+                psi[ix * n_y + iy] = psi_nlm(o.n, o.l, o.m, sph_coord[0], sph_coord[1], sph_coord[2]);
+            }
+    };
+
+    const Orbital orbitals[] = { {1, 0, 0}, {3, 2, -1}, {4, 3, 2}, {5, 4, -3} };
+    const double half = 1.5e-9;
+    ScratchArenas scratch;
+    for (const Orbital &o : orbitals) {
+        for (int size : {49, 50}) {
+            std::vector<complexd_t> value(size * size), reference(size * size);
+            get_psi(o.n, o.l, o.m, 0.8, 0.3, -half, half, -half, half, size, size, value.data());
+            direct_slice(o, 0.8, 0.3, -half, half, -half, half, size, size, reference.data());
+            report("get_psi", o, size, relative_error(value.data(), reference.data(), value.size()));
+
+            get_psi(o.n, o.l, o.m, 2.1, 1.2, -half / 3, half, -half, half / 2, size, size, value.data());
+            direct_slice(o, 2.1, 1.2, -half / 3, half, -half, half / 2, size, size, reference.data());
+            report("get_psi off", o, size, relative_error(value.data(), reference.data(), value.size()));
+
+            RotatedSlice rotated;
+            rotated.setState(o.n, o.l, o.m, -half, half, -half, half, size, size);
+            while (!rotated.ready())
+                rotated.build(1e6);
+            direct_slice(o, 0.8, 0.3, -half, half, -half, half, size, size, reference.data());
+            const complexd_t *rendered = rotated.render(0.8, 0.3, scratch.local());
+            report("rotated", o, size, relative_error(rendered, reference.data(), reference.size()));
+            scratch.reset();
+        }
+        for (int size : {15, 16}) {
+            size_t total = (size_t)size * size * size;
+            complexd_t *volume = get_volume(o.n, o.l, o.m, half, size);
+            std::vector<complexd_t> reference(total);
+            std::vector<double> axis(size);
+            linspace(-half, half, size, axis.data());
+            for (int k = 0; k < size; k++)
+                for (int j = 0; j < size; j++)
+                    for (int i = 0; i < size; i++) {
+                        double cart[3] = { axis[i], axis[j], axis[k] }, sph[3];
+                        spherical_from_cart(cart, sph);
+                        reference[((size_t)k * size + j) * size + i] = psi_nlm(o.n, o.l, o.m, sph[0], sph[1], sph[2]);
+                    }
+            report("get_volume", o, size, relative_error(volume, reference.data(), total));
+            delete[] volume;
+        }
+    }
+
+    // Sizes with every radix, odd and even along each axis
+    const int shapes[][3] = { {15, 9, 10}, {16, 12, 8}, {10, 25, 6} };
+    for (const auto &shape : shapes) {
+        int nx = shape[0], ny = shape[1], nz = shape[2];
+        size_t total = (size_t)nx * ny * nz;
+        std::vector<double> real(total);
+        std::vector<complexd_t> data(total);
+        for (size_t i = 0; i < total; i++) {
+            real[i] = std::sin(0.37 * i) + 0.1 * (i % 7);
+            data[i] = { real[i], std::cos(1.3 * i) };
+        }
+        for (int sign : {-1, 1}) {
+            std::vector<complexd_t> transformed(data);
+            fft3d(transformed.data(), nx, ny, nz, sign);
+            std::vector<complexd_t> reference(total);
+            for (int kz = 0; kz < nz; kz++)
+                for (int ky = 0; ky < ny; ky++)
+                    for (int kx = 0; kx < nx; kx++) {
+                        complexd_t sum = 0;
+                        for (int z = 0; z < nz; z++)
+                            for (int y = 0; y < ny; y++)
+                                for (int x = 0; x < nx; x++) {
+                                    double turns = (double)kx * x / nx + (double)ky * y / ny + (double)kz * z / nz;
+                                    sum += data[((size_t)z * ny + y) * nx + x] * std::polar(1.0, sign * 2 * M_PI * turns);
+                                }
+                        reference[((size_t)kz * ny + ky) * nx + kx] = sum;
+                    }
+            double error = relative_error(transformed.data(), reference.data(), total);
+            printf("fft3d        %2d  %2dx%2dx%2d  relative error %.1e\n", sign, nx, ny, nz, error);
+            assert(error < tolerance);
+            if (sign == 1 || nx % 2 != 0)
+                continue;
+
+            // rfft3d keeps the non-redundant half of the forward transform
+            int nh = nx / 2 + 1;
+            std::vector<complexd_t> half_spectrum((size_t)nh * ny * nz), expected((size_t)nh * ny * nz);
+            std::vector<complexd_t> forward(total);
+            for (size_t i = 0; i < total; i++)
+                forward[i] = real[i];
+            fft3d(forward.data(), nx, ny, nz, -1);
+            rfft3d(real.data(), half_spectrum.data(), nx, ny, nz);
+            for (int kz = 0; kz < nz; kz++)
+                for (int ky = 0; ky < ny; ky++)
+                    for (int kx = 0; kx < nh; kx++)
+                        expected[((size_t)kz * ny + ky) * nh + kx] = forward[((size_t)kz * ny + ky) * nx + kx];
+            error = relative_error(half_spectrum.data(), expected.data(), expected.size());
+            printf("rfft3d       %2d  %2dx%2dx%2d  relative error %.1e\n", sign, nx, ny, nz, error);
+            assert(error < tolerance);
+        }
+    }
+}
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
 void processInput(GLFWwindow *window)
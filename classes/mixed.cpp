@@ -0,0 +1,131 @@
+#include "../headers/mixed.h"
+
+inline const double pi = 3.141592653589793;
+
+// Number of samples in the radial density table
+static const int table_size = 8192;
+
+MixedState::MixedState() {
+    this->table_rmax = 0;
+    this->valid = false;
+}
+
+void MixedState::clear() {
+    levels.clear();
+    valid = false;
+}
+
+void MixedState::add(int n, int l, int m, double w) {
+    std::vector<double> &ws = levels[{n, l}];
+    ws.resize(2 * l + 1, 0.0);
+    ws[m + l] += w;
+    valid = false;
+}
+
+// Every state of shell n with weight w
+void MixedState::addShell(int n, double w) {
+    for (int l{0}; l < n; l++)
+        for (int m{-l}; m <= l; m++)
+            add(n, l, m, w);
+}
+
+// Boltzmann distribution over all states with n <= n_max at temperature
+// kT (in Hartree), normalised to unit total weight
+MixedState MixedState::thermal(int n_max, double kT) {
+    MixedState mix;
+    double z{0};
+    for (int n{1}; n <= n_max; n++)
+        z += n * n * std::exp(-(energy(n) - energy(1)) / kT);
+    for (int n{1}; n <= n_max; n++)
+        mix.addShell(n, std::exp(-(energy(n) - energy(1)) / kT) / z);
+    return mix;
+}
+
+// Splits every level into its m-independent part, which goes into the
+// radial table, and whatever is left over per substate
+void MixedState::reduce() {
+    residual.clear();
+    std::vector<Term> radial_terms;
+    table_rmax = 0;
+    for (const auto &[nl, ws] : levels){
+        auto [n, l] = nl;
+        double common { *std::min_element(ws.begin(), ws.end()) };
+        if (common != 0)
+            radial_terms.push_back({n, l, 0, common});
+        for (int m{-l}; m <= l; m++)
+            if (ws[m + l] != common)
+                residual.push_back({n, l, m, ws[m + l] - common});
+
+        // Beyond this radius the level contributes less than 1e-12 of its peak density
+        double peak{0};
+        for (int j{0}; j <= 256; j++)
+            peak = std::max(peak, Rnl_envelope(n, l, j * n * n * a0 / 256.0));
+        table_rmax = std::max(table_rmax, radial_cutoff(n, l, 1e-6 * peak * Ylm_bound(l)));
+    }
+
+    table.assign(table_size + 1, 0.0);
+    for (const Term &t : radial_terms){
+        double factor { t.w * (2 * t.l + 1) / (4 * pi) };
+        for (int i{0}; i <= table_size; i++)
+            table[i] += factor * std::norm(Rnl(t.n, t.l, table_rmax * i / table_size));
+    }
+    valid = true;
+}
+
+// Linearly interpolated radial part of the density
+double MixedState::radial(double r) {
+    double x { r / table_rmax * table_size };
+    if (!(x < table_size))
+        return 0;
+    int i { (int)x };
+    double f { x - i };
+    return table[i] * (1 - f) + table[i + 1] * f;
+}
+
+double MixedState::density(double r, double theta, double phi) {
+    if (!valid)
+        reduce();
+    double rho { radial(r) };
+    for (const Term &t : residual)
+        rho += t.w * std::norm(psi_nlm(t.n, t.l, t.m, r, theta, phi));
+    return rho;
+}
+
+// Square root of the density on the same plane and pixel order as
+// get_psi, so it can be coloured like a wavefunction of phase zero
+complexd_t *MixedState::get_psi(double phi_c, double theta_c, double xmin, double xmax,
+                                double ymin, double ymax, int n_x, int n_y) {
+    complexd_t *psi { new complexd_t[n_x * n_y] };
+    get_psi(phi_c, theta_c, xmin, xmax, ymin, ymax, n_x, n_y, psi);
+    return psi;
+}
+
+// Same, into a caller's buffer of n_x * n_y values
+void MixedState::get_psi(double phi_c, double theta_c, double xmin, double xmax,
+                         double ymin, double ymax, int n_x, int n_y, complexd_t *psi) {
+    if (!valid)
+        reduce();
+    double deltax = (xmax - xmin)/n_x;
+    double deltay = (ymax - ymin)/n_y;
+    double unit_xp[3], unit_yp[3], unit_zp[3];
+    plane_basis(phi_c, theta_c, unit_xp, unit_yp, unit_zp);
+
+    ThreadPool::global().parallel_for(n_x, [&](int ix){
+        for (int iy{0}; iy < n_y; iy++){
+            int i { ix * n_y + iy };
+            double x_p = xmin + deltax * ix;
+            double y_p = ymin + deltay * iy;
+            if (residual.empty()){
+                // Purely radial: no need for the angles
+                psi[i] = std::sqrt(radial(std::sqrt(x_p * x_p + y_p * y_p)));
+                continue;
+            }
+            double p_coord[3] { x_p, y_p, 0 };
+            double car_coord[3];
+            convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
+            double sph_coord[3];
+            spherical_from_cart(car_coord, sph_coord);
+            psi[i] = std::sqrt(density(sph_coord[0], sph_coord[1], sph_coord[2]));
+        }
+    });
+}
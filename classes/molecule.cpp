@@ -0,0 +1,223 @@
+#include "../headers/molecule.h"
+
+// Side length in pixels of the square tiles that share one candidate list
+static const int tile_size = 16;
+
+Molecule::Molecule() {
+    this->rel_tol = 1e-3;
+    this->cell = 0;
+    for (int i{0}; i < 3; i++){
+        this->origin[i] = 0;
+        this->dims[i] = 0;
+    }
+}
+
+void Molecule::setCentres(const std::vector<Centre> &centres) {
+    bool same = centres.size() == this->centres.size()
+        && std::equal(centres.begin(), centres.end(), this->centres.begin(),
+                [](const Centre &a, const Centre &b){
+                    return a.pos[0] == b.pos[0] && a.pos[1] == b.pos[1]
+                        && a.pos[2] == b.pos[2] && a.n == b.n && a.l == b.l
+                        && a.m == b.m && a.c == b.c;
+                });
+    if (same)
+        return;
+    this->centres = centres;
+    buildGrid();
+}
+
+// Contributions smaller than rel_tol times the largest possible value of
+// an orbital are dropped
+void Molecule::setTolerance(double rel_tol) {
+    this->rel_tol = rel_tol;
+    buildGrid();
+}
+
+size_t Molecule::centreCount() {
+    return centres.size();
+}
+
+void Molecule::buildGrid() {
+    cell = 0;
+    double lo[3] { 0, 0, 0 };
+    double hi[3] { 0, 0, 0 };
+    for (size_t i{0}; i < centres.size(); i++){
+        Centre &c = centres[i];
+        // Reference scale: peak of the envelope, sampled up to where it
+        // starts to decrease monotonically
+        double peak{0};
+        for (int j{0}; j <= 256; j++)
+            peak = std::max(peak, Rnl_envelope(c.n, c.l, j * c.n * c.n * a0 / 256.0));
+        peak *= Ylm_bound(c.l);
+        c.cutoff = radial_cutoff(c.n, c.l, rel_tol * peak);
+        cell = std::max(cell, c.cutoff);
+        for (int k{0}; k < 3; k++){
+            lo[k] = i == 0 ? c.pos[k] : std::min(lo[k], c.pos[k]);
+            hi[k] = i == 0 ? c.pos[k] : std::max(hi[k], c.pos[k]);
+        }
+    }
+    if (cell == 0)
+        cell = 1;
+
+    for (int k{0}; k < 3; k++){
+        origin[k] = lo[k];
+        dims[k] = (int)((hi[k] - lo[k]) / cell) + 1;
+    }
+    int ncells { dims[0] * dims[1] * dims[2] };
+
+    // Counting sort of the centres into cells
+    std::vector<int> cell_of(centres.size());
+    cell_start.assign(ncells + 1, 0);
+    for (size_t i{0}; i < centres.size(); i++){
+        int idx[3];
+        for (int k{0}; k < 3; k++)
+            idx[k] = std::min(dims[k] - 1, (int)((centres[i].pos[k] - origin[k]) / cell));
+        cell_of[i] = (idx[2] * dims[1] + idx[1]) * dims[0] + idx[0];
+        cell_start[cell_of[i] + 1]++;
+    }
+    for (int c{0}; c < ncells; c++)
+        cell_start[c + 1] += cell_start[c];
+    cell_items.resize(centres.size());
+    std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    for (size_t i{0}; i < centres.size(); i++)
+        cell_items[fill[cell_of[i]]++] = (int)i;
+}
+
+// Writes to out the centres whose cutoff sphere intersects the sphere of
+// the given radius around pos and returns how many there are. out needs
+// room for every centre.
+int Molecule::query(const double pos[3], double radius, int *out) {
+    int found{0};
+    int lo[3], hi[3];
+    for (int k{0}; k < 3; k++){
+        // Cells are at least as wide as any cutoff, so one extra cell
+        // on each side covers every centre that can reach the sphere
+        lo[k] = std::max(0, (int)std::floor((pos[k] - radius - origin[k]) / cell));
+        hi[k] = std::min(dims[k] - 1, (int)std::floor((pos[k] + radius - origin[k]) / cell) + 1);
+        lo[k] = std::max(0, lo[k] - 1);
+        if (lo[k] > hi[k])
+            return 0;
+    }
+    for (int z{lo[2]}; z <= hi[2]; z++)
+        for (int y{lo[1]}; y <= hi[1]; y++)
+            for (int x{lo[0]}; x <= hi[0]; x++){
+                int c { (z * dims[1] + y) * dims[0] + x };
+                for (int j{cell_start[c]}; j < cell_start[c + 1]; j++){
+                    const Centre &centre = centres[cell_items[j]];
+                    double d2{0};
+                    for (int k{0}; k < 3; k++)
+                        d2 += (pos[k] - centre.pos[k]) * (pos[k] - centre.pos[k]);
+                    double reach { centre.cutoff + radius };
+                    if (d2 < reach * reach)
+                        out[found++] = cell_items[j];
+                }
+            }
+    return found;
+}
+
+complexd_t Molecule::evaluate(const Centre &centre, const double pos[3]) {
+    double rel[3] { pos[0] - centre.pos[0], pos[1] - centre.pos[1], pos[2] - centre.pos[2] };
+    double sph[3];
+    spherical_from_cart(rel, sph);
+    if (sph[0] >= centre.cutoff)
+        return 0;
+    return centre.c * psi_nlm(centre.n, centre.l, centre.m, sph[0], sph[1], sph[2]);
+}
+
+complexd_t Molecule::psi(const double pos[3]) {
+    std::vector<int> near(centres.size());
+    int count { query(pos, 0, near.data()) };
+    complexd_t sum{0};
+    for (int k{0}; k < count; k++)
+        sum += evaluate(centres[near[k]], pos);
+    return sum;
+}
+
+// Same plane and pixel order as get_psi in wavefunction.cpp
+complexd_t *Molecule::get_psi(double phi_c, double theta_c, double xmin, double xmax,
+                              double ymin, double ymax, int n_x, int n_y) {
+    complexd_t *psi { new complexd_t[n_x * n_y] };
+    ScratchArenas scratch;
+    get_psi(phi_c, theta_c, xmin, xmax, ymin, ymax, n_x, n_y, psi, scratch);
+    return psi;
+}
+
+// Same, into a caller's buffer of n_x * n_y values. The candidate lists of
+// the tiles are taken from scratch.
+void Molecule::get_psi(double phi_c, double theta_c, double xmin, double xmax,
+                       double ymin, double ymax, int n_x, int n_y,
+                       complexd_t *psi, ScratchArenas &scratch) {
+    double deltax = (xmax - xmin)/n_x;
+    double deltay = (ymax - ymin)/n_y;
+    double unit_xp[3], unit_yp[3], unit_zp[3];
+    plane_basis(phi_c, theta_c, unit_xp, unit_yp, unit_zp);
+
+    std::fill(psi, psi + n_x * n_y, complexd_t{0});
+    ThreadPool::global().parallel_for_tiles(n_x, n_y, tile_size, tile_size,
+            [&](int tx, int ex, int ty, int ey){
+        // Bounding sphere of the tile
+        double half_w { deltax * (ex - tx - 1) / 2 };
+        double half_h { deltay * (ey - ty - 1) / 2 };
+        double p_mid[3] { xmin + deltax * tx + half_w, ymin + deltay * ty + half_h, 0 };
+        double mid[3];
+        convert_to_basis(p_mid, unit_xp, unit_yp, unit_zp, mid);
+        Arena::Scope scope { scratch.local() };
+        int *near { scratch.local().take<int>(centres.size()) };
+        int count { query(mid, std::sqrt(half_w * half_w + half_h * half_h), near) };
+        if (count == 0)
+            return;
+
+        for (int ix{tx}; ix < ex; ix++){
+            for (int iy{ty}; iy < ey; iy++){
+                double p_coord[3] { xmin + deltax * ix, ymin + deltay * iy, 0 };
+                double car_coord[3];
+                convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
+                complexd_t sum{0};
+                for (int k{0}; k < count; k++)
+                    sum += evaluate(centres[near[k]], car_coord);
+                psi[ix * n_y + iy] = sum;
+            }
+        }
+    });
+}
+
+// Hydrogen molecular ion at its equilibrium bond length of 2 Bohr radii,
+// sigma_g (bonding) or sigma_u (antibonding) combination of 1s orbitals
+std::vector<Centre> Molecule::h2plus(bool bonding) {
+    double c { 1 / std::sqrt(2.0) };
+    return {
+        {{-a0, 0, 0}, 1, 0, 0, c, 0},
+        {{ a0, 0, 0}, 1, 0, 0, bonding ? c : -c, 0},
+    };
+}
+
+// count identical orbitals evenly spaced along the x axis, centred at the origin
+std::vector<Centre> Molecule::chain(int count, double spacing, int n, int l, int m) {
+    std::vector<Centre> res;
+    double c { 1 / std::sqrt((double)count) };
+    for (int i{0}; i < count; i++){
+        double x { (i - (count - 1) / 2.0) * spacing };
+        res.push_back({{x, 0, 0}, n, l, m, c, 0});
+    }
+    return res;
+}
+
+// Square lattice of identical orbitals in the xy plane, centred at the origin
+std::vector<Centre> Molecule::lattice(int count_x, int count_y, double spacing, int n, int l, int m) {
+    std::vector<Centre> res;
+    double c { 1 / std::sqrt((double)(count_x * count_y)) };
+    for (int i{0}; i < count_x; i++){
+        for (int j{0}; j < count_y; j++){
+            double x { (i - (count_x - 1) / 2.0) * spacing };
+            double y { (j - (count_y - 1) / 2.0) * spacing };
+            res.push_back({{x, y, 0}, n, l, m, c, 0});
+        }
+    }
+    return res;
+}
+
+// 4x4 square lattice of one orbital, spaced so that neighbouring
+// orbitals overlap
+std::vector<Centre> Molecule::overlapping_lattice(int n, int l, int m) {
+    return lattice(4, 4, 3 * n * n * a0, n, l, m);
+}
@@ -12,6 +12,27 @@ Plane::Plane(float width, float height, int tileW, int tileH) {
     this->awidth = 6e-9;
     this->aheight = 6e-9;
     this->norm_const = 1e15;
+    this->mode = Mode::Slice;
+    this->shell_n = 0;
+    this->lattice_n = 0;
+    this->lattice_l = 0;
+    this->lattice_m = 0;
+    this->show_current = false;
+    this->frame_budget_us = 8000;
+    this->amortised = false;
+    this->tiled = false;
+    this->version = 1;
+    this->drawn = {};
+    this->log_scale = false;
+    this->shown_key = {};
+    this->shown_image = nullptr;
+    this->prefetched = false;
+    this->streamlines_stale = false;
+    this->last_input = {};
+    this->preview_shown = false;
+    this->full_requested = false;
+    this->full_rendered = false;
+    preview_molecule.setTolerance(1e-2);
 
     generateVertices();
     generateIndices();
@@ -45,16 +66,60 @@ int Plane::getl(){
 int Plane::getm(){
     return m;
 }
+int Plane::getTileW(){
+    return tileW;
+}
+int Plane::getTileH(){
+    return tileH;
+}
+
+// Changes the number of samples of the plane. The vertices and indices
+// are rebuilt, so both buffers have to be uploaded again, and the next
+// updateColors renders at the new size. Until then the new vertices show
+// the old image, resampled by nearest pixel. Returns whether it changed.
+bool Plane::setResolution(int tileW, int tileH) {
+    if (tileW == this->tileW && tileH == this->tileH)
+        return false;
+    int oldW { this->tileW };
+    int oldH { this->tileH };
+    std::vector<float> old { std::move(vertices) };
+    this->tileW = tileW;
+    this->tileH = tileH;
+    generateVertices();
+    generateIndices();
+    // Samples sit at the start of their cells, the same extent at both sizes
+    for (int y{0}; y < tileH; y++){
+        int oy { std::min(oldH - 1, (int)std::lround((double)y * oldH / tileH)) };
+        for (int x{0}; x < tileW; x++){
+            int ox { std::min(oldW - 1, (int)std::lround((double)x * oldW / tileW)) };
+            const float *from { old.data() + ((size_t)oy * oldW + ox) * 6 + 3 };
+            float *to { vertices.data() + ((size_t)y * tileW + x) * 6 + 3 };
+            std::copy(from, from + 3, to);
+        }
+    }
+    // The image on screen has the old size, so it is not cached on leaving
+    shown_image = nullptr;
+    prefetcher.cancel();
+    prefetched = false;
+    streamlines_stale = true;
+    invalidate();
+    return true;
+}
 void Plane::increment_n() {
     n++;
+    invalidate();
 }
 void Plane::increment_l() {
-    if (l < n-1)
+    if (l < n-1){
         l++;
+        invalidate();
+    }
 }
 void Plane::increment_m() {
-    if (m < l)
+    if (m < l){
         m++;
+        invalidate();
+    }
 }
 void Plane::decrement_n() {
     if (n > 1){
@@ -62,6 +127,7 @@ void Plane::decrement_n() {
         if (l > n-1){
             decrement_l();
         }
+        invalidate();
     }
 }
 void Plane::decrement_l() {
@@ -73,48 +139,477 @@ void Plane::decrement_l() {
             increment_m();
         }
         l--;
+        invalidate();
     }
 }
 void Plane::decrement_m() {
-    if (m > -l)
+    if (m > -l){
         m--;
+        invalidate();
+    }
 }
+// Sensitivity is applied by the fragment shader, see getNormalization. It
+// stops at the sensitivity that the progressive renderer culls against.
 void Plane::incSensitivity() {
-    norm_const *= 0.99;
+    norm_const = std::max(min_normalization, norm_const * 0.99);
 }
 void Plane::decSensitivity() {
     norm_const *= 1.01;
 }
+double Plane::getNormalization() {
+    return norm_const;
+}
+// Brightness proportional to log|psi| instead of |psi|, which shows the
+// faint outer lobes and the bright inner ones at the same time
+void Plane::toggleLogScale() {
+    log_scale = !log_scale;
+}
+bool Plane::logScale() {
+    return log_scale;
+}
 void Plane::zoomIn() {
     awidth *= 0.99;
     aheight *= 0.99;
+    invalidate();
 }
 void Plane::zoomOut() {
     awidth *= 1.01;
     aheight *= 1.01;
+    invalidate();
 }
 
-void Plane::updateColors(double phi, double theta) {
-    double* colors = get_colors(n, l, m, phi, theta,
-        -awidth/2, awidth/2, -aheight/2, aheight/2, tileW, tileH, norm_const);
-    //double* colors = get_colors2_electric_boogaloo(n, l, m, phi, theta, -3e-9, 3e-9, -3e-9, 3e-9, 3e-9, tileW, tileH, 40);
+void Plane::invalidate() {
+    version++;
+}
 
-    for ( int y = 0; y < tileH; y++ ) {
-        for ( int x = 0; x < tileW * 6; x += 6 ) {
-            vertices[y*tileW*6 + x + 3] = (float)colors[y*tileW*4 + x/6*4];
-            vertices[y*tileW*6 + x + 4] = (float)colors[y*tileW*4 + x/6*4 + 1];
-            vertices[y*tileW*6 + x + 5] = (float)colors[y*tileW*4 + x/6*4 + 2];
+// States shown by the evolution mode, e.g. coefficients from decompose().
+// An empty vector restores the default of the current state and the next shell.
+void Plane::setSuperposition(const std::vector<State> &states) {
+    superposition = states;
+    invalidate();
+}
+
+const std::vector<State> &Plane::evolutionStates() {
+    if (!superposition.empty())
+        return superposition;
+    // Equal superposition of the current state and the next shell,
+    // which beats with period 2pi/(E_(n+1) - E_n)
+    double c {1 / std::sqrt(2.0)};
+    default_states.assign({{n, l, m, c}, {n+1, l, m, c}});
+    return default_states;
+}
+
+// Switches the slice between progressive refinement, which restarts on
+// every change, and temporal amortisation, which keeps the image across
+// camera moves and updates a budgeted subset of pixels per frame
+void Plane::toggleAmortised() {
+    amortised = !amortised;
+    invalidate();
+}
+bool Plane::isAmortised() {
+    return amortised;
+}
+
+// Switches the slice to the tile pyramid, which draws every view from
+// cached tiles of the nearest finer level, so that deep zooms only
+// render the tiles that come into view
+void Plane::toggleTiled() {
+    tiled = !tiled;
+    invalidate();
+}
+bool Plane::isTiled() {
+    return tiled;
+}
+
+void Plane::cycleMode() {
+    switch (mode){
+        case Mode::Slice: mode = Mode::Evolution; break;
+        case Mode::Evolution: mode = Mode::Molecule; break;
+        case Mode::Molecule: mode = Mode::Shell; break;
+        case Mode::Shell: mode = Mode::Slice; break;
+    }
+    invalidate();
+}
+Plane::Mode Plane::getMode() {
+    return mode;
+}
+std::string Plane::modeName() {
+    switch (mode){
+        case Mode::Slice: return "slice";
+        case Mode::Evolution: return "evolution";
+        case Mode::Molecule: return "lattice";
+        case Mode::Shell: return "shell average";
+    }
+    return "";
+}
+
+// Called every frame with whether a key that moves the view is held
+void Plane::setInteracting(bool active) {
+    if (active)
+        last_input = std::chrono::steady_clock::now();
+}
+
+bool Plane::previewing() {
+    return std::chrono::steady_clock::now() - last_input
+        < std::chrono::duration<double, std::milli>(settle_ms);
+}
+
+// Whether the colours show a preview that a full image will replace
+bool Plane::showsPreview() {
+    return preview_shown;
+}
+
+// Whether the colours of the last updateColors were rendered, so that its
+// time says what the current resolution costs
+bool Plane::rendered() {
+    return full_rendered;
+}
+
+// Brings the vertex colours up to date and returns whether they changed.
+// Frames in which nothing changed and no renderer is still refining do no
+// work at all.
+bool Plane::updateColors(double phi, double theta, double t) {
+    bool changed { version != drawn.version || phi != drawn.phi || theta != drawn.theta
+                   || (mode == Mode::Evolution && t != drawn.t) };
+    full_rendered = false;
+    if (!changed && drawn.complete){
+        prefetchNeighbours();
+        return false;
+    }
+    if (!changed && preview_shown)
+        return previewing() ? false : showFull();
+    // Interactive work first: speculative renders stop at their next row
+    prefetcher.cancel();
+    prefetched = false;
+    bool turning { phi != drawn.phi || theta != drawn.theta };
+    bool finished { drawn.complete };
+    drawn = { version, phi, theta, t, true };
+    preview_shown = false;
+    const complexd_t *shown;
+    // Nothing taken from the arenas outlives this call
+    scratch.reset();
+
+    // When the state changes, the finished image on screen goes into the
+    // cache and the new state is looked up in it. Moving the camera or
+    // zooming alone does neither, so that continuous motion does not
+    // churn the cache. The evolution depends on t and is never cached.
+    SliceKey key { n, l, m, (int)mode, phi, theta, awidth, aheight, tileW, tileH };
+    bool new_state { key.n != shown_key.n || key.l != shown_key.l
+                     || key.m != shown_key.m || key.mode != shown_key.mode };
+    // Images that had to be rendered also go to disk, for the next start
+    size_t bytes { (size_t)tileW * tileH * sizeof(complexd_t) };
+    if (new_state && finished && shown_image){
+        cache.insert(shown_key, shown_image);
+        DiskCache::global().storeLater(slice_disk_key(shown_key), shown_image, bytes);
+    }
+    shown_key = key;
+    shown_image = nullptr;
+    if (new_state && mode != Mode::Evolution){
+        const complexd_t *cached { cache.find(key) };
+        if (!cached){
+            image.resize(tileW * tileH);
+            if (DiskCache::global().load(slice_disk_key(key), image.data(), bytes)){
+                cache.insert(key, image.data());
+                cached = image.data();
+            }
         }
+        if (cached){
+            // Already in the cache, so nothing to insert when leaving it
+            setColors(cached);
+            return true;
+        }
+    }
+    if (previewing() && renderPreview(phi, theta, t, turning)){
+        setColors(image.data());
+        drawn.complete = false;
+        preview_shown = true;
+        full_requested = false;
+        return true;
     }
 
-    delete colors;
+    // Whether the slice cache may keep the image; the evolution depends on t
+    bool cacheable { mode != Mode::Evolution };
+    if (mode == Mode::Evolution){
+        evolution.setStates(evolutionStates());
+        evolution.setView(phi, theta,
+            -awidth/2, awidth/2, -aheight/2, aheight/2, tileW, tileH);
+        shown = evolution.evolve(t);
+    }
+    else if (mode == Mode::Molecule){
+        updateLattice();
+        image.resize(tileW * tileH);
+        molecule.get_psi(phi, theta,
+            -awidth/2, awidth/2, -aheight/2, aheight/2, tileW, tileH, image.data(), scratch);
+        shown = image.data();
+    }
+    else if (mode == Mode::Shell){
+        updateShell();
+        image.resize(tileW * tileH);
+        shell.get_psi(phi, theta,
+            -awidth/2, awidth/2, -aheight/2, aheight/2, tileW, tileH, image.data());
+        shown = image.data();
+    }
+    else if (amortised){
+        amortiser.setState(n, l, m,
+            -awidth/2, awidth/2, -aheight/2, aheight/2, tileW, tileH);
+        amortiser.setView(phi, theta);
+        changed = amortiser.update(frame_budget_us) || changed;
+        drawn.complete = amortiser.converged();
+        shown = amortiser.image();
+    }
+    else if (tiled){
+        // Nearest samples of the tiles, so not the exact image of the key
+        // and not cached
+        pyramid.setState(n, l, m, phi, theta);
+        image.resize(tileW * tileH);
+        changed = pyramid.render(-awidth/2, awidth/2, -aheight/2, aheight/2, tileW, tileH,
+            image.data(), frame_budget_us) || changed;
+        drawn.complete = pyramid.complete();
+        cacheable = false;
+        shown = image.data();
+    }
+    else {
+        // Once the z = 0 slices of this (n, l) are cached, any camera angle
+        // and any m is a short sum of them. They are built while the camera
+        // turns, in half of the frame budget.
+        double budget { frame_budget_us };
+        rotated.setState(n, l, m,
+            -awidth/2, awidth/2, -aheight/2, aheight/2, tileW, tileH);
+        if (!rotated.ready() && turning){
+            rotated.build(budget / 2);
+            budget /= 2;
+        }
+        if (rotated.ready()){
+            shown = rotated.render(phi, theta, scratch.local());
+        }
+        else {
+            // Coarse image first, refined on every call and finished with exact
+            // passes over what the refinement interpolated, so done() means exact
+            progressive.setState(n, l, m, phi, theta,
+                -awidth/2, awidth/2, -aheight/2, aheight/2, tileW, tileH);
+            changed = progressive.refine(budget) || changed;
+            drawn.complete = progressive.done();
+            shown = progressive.image();
+        }
+        //double* colors = get_colors2_electric_boogaloo(n, l, m, phi, theta, -3e-9, 3e-9, -3e-9, 3e-9, 3e-9, tileW, tileH, 40);
+    }
+    if (cacheable)
+        shown_image = shown;
+    if (changed)
+        setColors(shown);
+    full_rendered = changed;
+    return changed;
+}
+
+// Renders a reduced image of the view into image and returns true, or
+// returns false if the full image is as cheap: the amortised renderer
+// already spreads its work over frames, zooming the tile pyramid mostly
+// reuses tiles, and once the rotated basis is built any view of the slice
+// is a short sum
+bool Plane::renderPreview(double phi, double theta, double t, bool turning) {
+    int pw { std::max(1, tileW / 2) };
+    int ph { std::max(1, tileH / 2) };
+    preview.resize(pw * ph);
+    switch (mode){
+        case Mode::Slice:
+            if (amortised || (tiled && !turning))
+                return false;
+            if (!tiled){
+                rotated.setState(n, l, m,
+                    -awidth/2, awidth/2, -aheight/2, aheight/2, tileW, tileH);
+                if (!rotated.ready() && turning)
+                    rotated.build(frame_budget_us / 2);
+                if (rotated.ready())
+                    return false;
+            }
+            get_psi(n, l, m, phi, theta,
+                -awidth/2, awidth/2, -aheight/2, aheight/2, pw, ph, preview.data());
+            break;
+        case Mode::Evolution:
+            preview_evolution.setStates(evolutionStates());
+            preview_evolution.setView(phi, theta,
+                -awidth/2, awidth/2, -aheight/2, aheight/2, pw, ph);
+            std::copy_n(preview_evolution.evolve(t), pw * ph, preview.data());
+            break;
+        case Mode::Molecule:
+            updateLattice();
+            preview_molecule.get_psi(phi, theta,
+                -awidth/2, awidth/2, -aheight/2, aheight/2, pw, ph, preview.data(), scratch);
+            break;
+        case Mode::Shell:
+            updateShell();
+            shell.get_psi(phi, theta,
+                -awidth/2, awidth/2, -aheight/2, aheight/2, pw, ph, preview.data());
+            break;
+    }
+    // Each preview sample covers the pixels nearest to it
+    image.resize(tileW * tileH);
+    for (int ix{0}; ix < tileW; ix++){
+        const complexd_t *row { preview.data() + std::min(pw - 1, ix * pw / tileW) * ph };
+        for (int iy{0}; iy < tileH; iy++)
+            image[ix * tileH + iy] = row[std::min(ph - 1, iy * ph / tileH)];
+    }
+    return true;
+}
+
+// Replaces the preview by the full image once the prefetcher has it.
+// Full images that change every frame, or that are a short sum by now,
+// are rendered by the next frame instead.
+bool Plane::showFull() {
+    if (mode == Mode::Evolution || (mode == Mode::Slice && !tiled && !amortised && rotated.ready())){
+        preview_shown = false;
+        invalidate();
+        return false;
+    }
+    prefetcher.collect(cache);
+    if (!cache.contains(shown_key)){
+        if (!full_requested){
+            neighbours.assign({ shown_key });
+            prefetcher.request(neighbours);
+            full_requested = true;
+        }
+        return false;
+    }
+    setColors(cache.find(shown_key));
+    preview_shown = false;
+    drawn.complete = true;
+    return true;
+}
+
+// The lattice of the current orbital, in the full and the preview molecule
+void Plane::updateLattice() {
+    if (lattice_n == n && lattice_l == l && lattice_m == m)
+        return;
+    std::vector<Centre> centres { Molecule::overlapping_lattice(n, l, m) };
+    molecule.setCentres(centres);
+    preview_molecule.setCentres(centres);
+    lattice_n = n;
+    lattice_l = l;
+    lattice_m = m;
+}
+
+// Density of the whole shell n, each of its n^2 states equally weighted
+void Plane::updateShell() {
+    if (shell_n == n)
+        return;
+    shell.clear();
+    shell.addShell(n, 1.0 / (n * n));
+    shell_n = n;
+}
+
+// Called on idle frames. Picks up what the prefetcher has finished and,
+// once per view, asks it for the slices of the states that the n, l and m
+// keys lead to from here, unless they are cached already.
+void Plane::prefetchNeighbours() {
+    prefetcher.collect(cache);
+    if (prefetched || mode != Mode::Slice)
+        return;
+    prefetched = true;
+
+    // The same moves as increment_n() ... decrement_m()
+    auto clamp_m = [](int m, int l){ return std::max(-l, std::min(l, m)); };
+    int moves[6][3] {
+        { n + 1, l, m },
+        { n - 1, std::min(l, n - 2), clamp_m(m, std::min(l, n - 2)) },
+        { n, l + 1, m },
+        { n, l - 1, clamp_m(m, l - 1) },
+        { n, l, m + 1 },
+        { n, l, m - 1 },
+    };
+    neighbours.clear();
+    for (const int *s : moves){
+        bool valid { s[0] >= 1 && s[1] >= 0 && s[1] <= s[0] - 1 && std::abs(s[2]) <= s[1] };
+        if (!valid)
+            continue;
+        SliceKey key { shown_key };
+        key.n = s[0];
+        key.l = s[1];
+        key.m = s[2];
+        if (!cache.contains(key))
+            neighbours.push_back(key);
+    }
+    if (!neighbours.empty())
+        prefetcher.request(neighbours);
+}
+
+SliceCache::Stats Plane::cacheStats() {
+    return cache.stats();
+}
+
+void Plane::setCacheCapacity(size_t bytes) {
+    cache.setCapacity(bytes);
+}
+
+void Plane::toggleCurrent() {
+    show_current = !show_current;
+}
+bool Plane::showsCurrent() {
+    return show_current;
+}
+float* Plane::getStreamlines() {
+    return streamlines.data();
+}
+size_t Plane::streamlinesSize() {
+    return streamlines.size() * sizeof(float);
+}
+
+// Retraces the probability current streamlines of the displayed state if
+// anything they depend on has changed, and rebuilds the GL_LINES vertices
+// (position and colour) on top of the plane. Returns whether they changed.
+bool Plane::updateStreamlines(double phi, double theta, double t) {
+    scratch.reset();
+    traced_states.clear();
+    if (mode == Mode::Evolution){
+        for (const State &s : evolutionStates())
+            traced_states.push_back({s.n, s.l, s.m, s.c * std::polar(1.0, -energy(s.n) * t)});
+    }
+    else {
+        traced_states.push_back({n, l, m, 1.0});
+    }
+    tracer.setStates(traced_states);
+    tracer.setView(phi, theta, -awidth/2, awidth/2, -aheight/2, aheight/2);
+    if (!tracer.trace(scratch) && !streamlines_stale)
+        return false;
+    streamlines_stale = false;
+
+    // Plane coordinate x_p runs along the vertex rows and y_p along the
+    // columns, see generateVertices
+    float xGap = ((float) width)/((float) tileW);
+    float yGap = ((float) height)/((float) tileH);
+    double deltax = awidth / tileW;
+    double deltay = aheight / tileH;
+    streamlines.clear();
+    for (const std::vector<double> &line : tracer.getLines()) {
+        for (size_t i = 2; i < line.size(); i += 2) {
+            for (size_t j = i - 2; j <= i; j += 2) {
+                streamlines.push_back(((line[j+1] + aheight/2) / deltay + 0.5) * xGap - width / 2.0f);
+                streamlines.push_back(((line[j] + awidth/2) / deltax + 0.25) * yGap - height / 2.0f);
+                // Just in front of the plane
+                streamlines.push_back(-0.001f);
+                streamlines.push_back(1.0f);
+                streamlines.push_back(1.0f);
+                streamlines.push_back(1.0f);
+            }
+        }
+    }
+    return true;
+}
+
+// Writes a complex image with get_colors' pixel order into the colour
+// attribute as (Re psi, Im psi, 0). fShader1.frag normalises it and
+// applies the phase colour map, so the raw values are all it needs.
+void Plane::setColors(const complexd_t *psi) {
+    store_psi(psi, tileW*tileH, colorSpan());
+}
+
+// The colour attribute of the interleaved (position, colour) vertices
+OutputSpan<float> Plane::colorSpan() {
+    return { vertices.data() + 3, 6 };
 }
 
 void Plane::generateVertices() {
     vertices.resize(tileW*tileH*3*2);
 
-    double* colors = get_colors(4, 3, 1, 0, glm::radians(45.0f), -3e-9, 3e-9, -3e-9, 3e-9, tileW, tileH);
-    
     float xGap = ((float) width)/((float) tileW);
     float yGap = ((float) height)/((float) tileH);
 
@@ -123,13 +618,10 @@ void Plane::generateVertices() {
             vertices[y*tileW*6 + x]     = (x+3)/6.0f * xGap - width / 2.0f;
             vertices[y*tileW*6 + x + 1] = (y+0.25) * yGap - height / 2.0f;
             vertices[y*tileW*6 + x + 2] = 0.0f;
-            vertices[y*tileW*6 + x + 3] = (float)colors[y*tileW*4 + x/6*4];
-            vertices[y*tileW*6 + x + 4] = (float)colors[y*tileW*4 + x/6*4 + 1];
-            vertices[y*tileW*6 + x + 5] = (float)colors[y*tileW*4 + x/6*4 + 2];
         }
     }
-
-    delete colors;
+    // Only the positions; the colours are left to setResolution and
+    // updateColors
 }
 
 void Plane::generateIndices() {
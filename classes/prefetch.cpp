@@ -0,0 +1,160 @@
+#include "../headers/prefetch.h"
+
+Prefetcher::Prefetcher() {
+    this->generation = 0;
+    this->busy = false;
+    this->stop = false;
+    this->shell_n = 0;
+}
+
+Prefetcher::~Prefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+        generation++;
+    }
+    wake.notify_all();
+    if (worker.joinable())
+        worker.join();
+}
+
+// Replaces whatever was still pending by keys. The thread is only started
+// by the first request.
+void Prefetcher::request(const std::vector<SliceKey> &keys) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+        jobs.assign(keys.rbegin(), keys.rend());
+        if (!worker.joinable())
+            worker = std::thread(&Prefetcher::work, this);
+    }
+    wake.notify_all();
+}
+
+// Drops the pending jobs and stops the running one at its next row.
+// Images that were already finished are kept, they are still correct.
+void Prefetcher::cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (jobs.empty() && !busy)
+        return;
+    generation++;
+    jobs.clear();
+}
+
+void Prefetcher::collect(SliceCache &cache) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const Result &r : results)
+        cache.insert(r.key, r.image.data());
+    results.clear();
+}
+
+void Prefetcher::work() {
+    ThreadPool::lower_priority();
+    ThreadPool::run_loops_inline();
+    std::vector<complexd_t> psi;
+    while (true){
+        SliceKey key;
+        unsigned long started;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]{ return stop || !jobs.empty(); });
+            if (stop)
+                return;
+            key = jobs.back();
+            jobs.pop_back();
+            started = generation;
+            busy = true;
+        }
+        // A previous run may have left it on disk
+        psi.resize((size_t)key.n_x * key.n_y);
+        CacheKey disk { slice_disk_key(key) };
+        size_t bytes { psi.size() * sizeof(complexd_t) };
+        bool finished { DiskCache::global().load(disk, psi.data(), bytes) };
+        if (!finished && render(key, started, psi)){
+            DiskCache::global().store(disk, psi.data(), bytes);
+            finished = true;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        busy = false;
+        if (finished)
+            results.push_back({key, std::move(psi)});
+    }
+}
+
+// The image of key, as the plane renders it. psi has room for the slice.
+// Returns false if it was cancelled or is of a mode that is not rendered.
+bool Prefetcher::render(const SliceKey &key, unsigned long started, std::vector<complexd_t> &psi) {
+    switch ((SliceMode)key.mode){
+        case SliceMode::Slice:
+            return renderOrbital(key, started, psi);
+        case SliceMode::Molecule:
+            molecule.setCentres(Molecule::overlapping_lattice(key.n, key.l, key.m));
+            return renderStrips(key, started, psi);
+        case SliceMode::Shell:
+            // The same weights as the plane's shell average
+            if (shell_n != key.n){
+                shell.clear();
+                shell.addShell(key.n, 1.0 / (key.n * key.n));
+                shell_n = key.n;
+            }
+            return renderStrips(key, started, psi);
+        case SliceMode::Evolution:
+            break;
+    }
+    return false;
+}
+
+// psi_nlm on the slice of key, as get_psi, one row at a time so that a
+// cancel takes effect within a row
+bool Prefetcher::renderOrbital(const SliceKey &key, unsigned long started, std::vector<complexd_t> &psi) {
+    int n_x { key.n_x }, n_y { key.n_y };
+    double xmin { -key.width / 2 }, xmax { key.width / 2 };
+    double ymin { -key.height / 2 }, ymax { key.height / 2 };
+    double deltax = (xmax - xmin)/n_x;
+    double deltay = (ymax - ymin)/n_y;
+    double unit_xp[3], unit_yp[3], unit_zp[3];
+    plane_basis(key.phi_c, key.theta_c, unit_xp, unit_yp, unit_zp);
+
+    bool symmetric_x { symmetric_range(xmin, xmax) };
+    bool symmetric_y { symmetric_range(ymin, ymax) };
+    for (int ix{0}; ix < n_x; ix++){
+        if (generation != started)
+            return false;
+        if (!fundamental(ix, n_x, symmetric_x))
+            continue;
+        for (int iy{0}; iy < n_y; iy++){
+            if (!fundamental(iy, n_y, symmetric_y))
+                continue;
+            double p_coord[3] { xmin + deltax * ix, ymin + deltay * iy, 0 };
+            double car_coord[3];
+            convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
+            double sph_coord[3];
+            spherical_from_cart(car_coord, sph_coord);
+            psi[ix * n_y + iy] = psi_nlm(key.n, key.l, key.m, sph_coord[0], sph_coord[1], sph_coord[2]);
+        }
+    }
+    fill_slice_symmetry(psi.data(), key.l, key.m, key.phi_c, n_x, n_y, symmetric_x, symmetric_y);
+    return generation == started;
+}
+
+// A lattice or shell image of key, 16 rows at a time: each strip is the
+// slice over the extent of its rows, with the same sample positions
+bool Prefetcher::renderStrips(const SliceKey &key, unsigned long started, std::vector<complexd_t> &psi) {
+    const int strip = 16;
+    double xmin { -key.width / 2 };
+    double ymin { -key.height / 2 }, ymax { key.height / 2 };
+    double deltax = key.width / key.n_x;
+    for (int first{0}; first < key.n_x; first += strip){
+        if (generation != started)
+            return false;
+        int last { std::min(key.n_x, first + strip) };
+        double x0 { xmin + deltax * first }, x1 { xmin + deltax * last };
+        complexd_t *rows { psi.data() + (size_t)first * key.n_y };
+        scratch.reset();
+        if ((SliceMode)key.mode == SliceMode::Molecule)
+            molecule.get_psi(key.phi_c, key.theta_c, x0, x1, ymin, ymax, last - first, key.n_y, rows, scratch);
+        else
+            shell.get_psi(key.phi_c, key.theta_c, x0, x1, ymin, ymax, last - first, key.n_y, rows);
+    }
+    return generation == started;
+}
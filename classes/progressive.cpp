@@ -0,0 +1,409 @@
+#include "../headers/progressive.h"
+
+// Spacing of the first pass and size of the root quadtree nodes
+static const int coarse_step = 8;
+// Nodes at least this large always subdivide, so that features smaller
+// than the coarse grid are not missed entirely
+static const int forced_size = 8;
+// A reprojected pixel is only trusted if the old pixels are magnified at
+// most this much, and if it has been interpolated for fewer frames than
+// the age limit. The limit is staggered per block so that blocks do not
+// all expire in the same frame.
+static const double max_magnification = 2;
+static const int max_age = 16;
+static const unsigned char invalid_age = 255;
+
+ProgressiveRenderer::ProgressiveRenderer() {
+    this->n = 0;
+    this->l = 0;
+    this->m = 0;
+    this->phi_c = 0;
+    this->theta_c = 0;
+    this->xmin = 0;
+    this->xmax = 0;
+    this->ymin = 0;
+    this->ymax = 0;
+    this->n_x = 0;
+    this->n_y = 0;
+    this->tol = 0.01;
+    this->deltax = 0;
+    this->deltay = 0;
+    this->scale = 0;
+    this->started = false;
+    this->finishing = false;
+}
+
+// Restarts the refinement if the state or the resolution has changed,
+// only rotates the phase if the camera azimuth has, and reprojects the
+// previous image if the zoom or the polar angle has
+void ProgressiveRenderer::setState(int n, int l, int m, double phi_c, double theta_c,
+                                   double xmin, double xmax, double ymin, double ymax,
+                                   int n_x, int n_y) {
+    bool same_state { started && n == this->n && l == this->l && m == this->m
+            && n_x == this->n_x && n_y == this->n_y };
+    bool same_plane { same_state && theta_c == this->theta_c
+            && xmin == this->xmin && xmax == this->xmax
+            && ymin == this->ymin && ymax == this->ymax };
+    if (same_plane && phi_c == this->phi_c)
+        return;
+    if (same_plane){
+        // Work still queued samples at the new angle, which matches
+        rotate_azimuth(psi.data(), n_x * n_y, m, phi_c - this->phi_c);
+        this->phi_c = phi_c;
+        plane_basis(phi_c, theta_c, unit_xp, unit_yp, unit_zp);
+        return;
+    }
+    View from { view() };
+    this->n = n;
+    this->l = l;
+    this->m = m;
+    this->phi_c = phi_c;
+    this->theta_c = theta_c;
+    this->xmin = xmin;
+    this->xmax = xmax;
+    this->ymin = ymin;
+    this->ymax = ymax;
+    this->n_x = n_x;
+    this->n_y = n_y;
+    deltax = (xmax - xmin)/n_x;
+    deltay = (ymax - ymin)/n_y;
+    plane_basis(phi_c, theta_c, unit_xp, unit_yp, unit_zp);
+    radial.setState(n, l, xmin, xmax, ymin, ymax, n_x, n_y);
+    if (same_state){
+        reproject(from);
+        return;
+    }
+    psi.assign(n_x * n_y, complexd_t{0});
+    age.assign(n_x * n_y, 0);
+    error.assign(n_x * n_y, 0);
+    urgent.clear();
+    refresh.clear();
+    started = false;
+}
+
+// Largest difference between neighbouring samples, relative to the
+// brightest coarse sample, that a node may have and still stop refining
+void ProgressiveRenderer::setTolerance(double tol) {
+    this->tol = tol;
+}
+
+bool ProgressiveRenderer::done() {
+    return started && finishing && urgent.empty() && refresh.empty();
+}
+
+const complexd_t *ProgressiveRenderer::image() {
+    return psi.data();
+}
+
+complexd_t ProgressiveRenderer::sample(int ix, int iy) {
+    double p_coord[3] { xmin + deltax * ix, ymin + deltay * iy, 0 };
+    double car_coord[3];
+    convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
+    double sph_coord[3];
+    spherical_from_cart(car_coord, sph_coord);
+    complexd_t value { radial.at(ix, iy) * Ylm(l, m, sph_coord[1], sph_coord[2]) };
+    psi[ix * n_y + iy] = value;
+    return value;
+}
+
+// Sets the block of the given size whose top left pixel is (ix, iy)
+void ProgressiveRenderer::fill(int ix, int iy, int size, complexd_t value) {
+    int ex { std::min(ix + size, n_x) };
+    int ey { std::min(iy + size, n_y) };
+    for (int x{ix}; x < ex; x++)
+        for (int y{iy}; y < ey; y++)
+            psi[x * n_y + y] = value;
+}
+
+// Refines the node of the given size whose corner (ix, iy) is exact
+void ProgressiveRenderer::node(int ix, int iy, int size) {
+    int half { size / 2 };
+    RadialInterval interval { rect_radial_interval(
+            xmin + deltax * ix, xmin + deltax * std::min(ix + size - 1, n_x - 1),
+            ymin + deltay * iy, ymin + deltay * std::min(iy + size - 1, n_y - 1)) };
+    // Black at any sensitivity, so the shader can change it freely
+    if (negligible(n, l, interval, min_normalization)){
+        fill(ix, iy, size, 0);
+        return;
+    }
+
+    // Quadrant corners; the first is our own corner and already exact
+    int qx[4] { ix, ix + half, ix, ix + half };
+    int qy[4] { iy, iy, iy + half, iy + half };
+    complexd_t value[4];
+    bool inside[4];
+    for (int q{0}; q < 4; q++){
+        inside[q] = qx[q] < n_x && qy[q] < n_y;
+        if (!inside[q])
+            continue;
+        value[q] = q == 0 ? psi[ix * n_y + iy] : sample(qx[q], qy[q]);
+        fill(qx[q], qy[q], half, value[q]);
+        // The corner pixel itself was overwritten with the same exact value
+    }
+    if (half == 1)
+        return;
+
+    // |a - b|^2 = (|a| - |b|)^2 + 2|a||b|(1 - cos(arg a - arg b)), so the
+    // complex difference picks up changes of both magnitude and phase
+    double error{0};
+    for (int a{0}; a < 4; a++)
+        for (int b{a + 1}; b < 4; b++)
+            if (inside[a] && inside[b]){
+                // The nucleus is not finite; refining towards it keeps it
+                // from spreading over a whole quadrant
+                double difference { std::abs(value[a] - value[b]) };
+                error = std::isfinite(difference) ? std::max(error, difference) : INFINITY;
+            }
+    if (size < forced_size && !(error > tol * scale)){
+        // Left for queueInterpolated. Our corner is only written by us.
+        this->error[ix * n_y + iy] = INFINITY;
+        return;
+    }
+
+    for (int q{0}; q < 4; q++)
+        if (inside[q]){
+            int cx { qx[q] }, cy { qy[q] };
+            ThreadPool::spawn([this, cx, cy, half]{ node(cx, cy, half); });
+        }
+}
+
+// Samples every coarse_step-th pixel and queues a node per coarse block
+void ProgressiveRenderer::coarsePass() {
+    int blocks_x { (n_x + coarse_step - 1) / coarse_step };
+    int blocks_y { (n_y + coarse_step - 1) / coarse_step };
+    std::vector<double> block_max(blocks_x, 0.0);
+    ThreadPool::global().parallel_for(blocks_x, [&](int bx){
+        for (int by{0}; by < blocks_y; by++){
+            complexd_t value { sample(bx * coarse_step, by * coarse_step) };
+            fill(bx * coarse_step, by * coarse_step, coarse_step, value);
+            if (std::isfinite(std::abs(value)))
+                block_max[bx] = std::max(block_max[bx], std::abs(value));
+        }
+    });
+    scale = *std::max_element(block_max.begin(), block_max.end());
+
+    for (int bx{0}; bx < blocks_x; bx++)
+        for (int by{0}; by < blocks_y; by++){
+            int cx { bx * coarse_step }, cy { by * coarse_step };
+            urgent.push_back([this, cx, cy]{ node(cx, cy, coarse_step); });
+        }
+    started = true;
+    finishing = false;
+}
+
+// Does up to budget_us microseconds of work. The coarse pass always
+// completes. Returns whether the image changed.
+bool ProgressiveRenderer::refine(double budget_us) {
+    if (done())
+        return false;
+    auto deadline { ThreadPool::Clock::now()
+        + std::chrono::microseconds((long long)budget_us) };
+    if (!started)
+        coarsePass();
+    ThreadPool::global().run_tasks(urgent, deadline);
+    if (urgent.empty() && !finishing)
+        queueInterpolated();
+    if (urgent.empty())
+        ThreadPool::global().run_tasks(refresh, deadline);
+    return true;
+}
+
+// Queues an exact pass over every coarse block in which a node stopped
+// refining, after whatever is already in the refresh queue
+void ProgressiveRenderer::queueInterpolated() {
+    int blocks_x { (n_x + coarse_step - 1) / coarse_step };
+    int blocks_y { (n_y + coarse_step - 1) / coarse_step };
+    for (int bx{0}; bx < blocks_x; bx++)
+        for (int by{0}; by < blocks_y; by++){
+            int cx { bx * coarse_step }, cy { by * coarse_step };
+            int ex { std::min(cx + coarse_step, n_x) };
+            int ey { std::min(cy + coarse_step, n_y) };
+            bool interpolated { false };
+            for (int x{cx}; x < ex && !interpolated; x++)
+                for (int y{cy}; y < ey; y++)
+                    if (std::isinf(error[x * n_y + y])){
+                        interpolated = true;
+                        break;
+                    }
+            if (interpolated)
+                refresh.push_back([this, cx, cy]{ exact(cx, cy); });
+        }
+    finishing = true;
+}
+
+ProgressiveRenderer::View ProgressiveRenderer::view() {
+    View v {};
+    v.xmin = xmin;
+    v.ymin = ymin;
+    v.deltax = deltax;
+    v.deltay = deltay;
+    for (int i{0}; i < 3; i++){
+        v.unit_xp[i] = unit_xp[i];
+        v.unit_yp[i] = unit_yp[i];
+        v.unit_zp[i] = unit_zp[i];
+    }
+    return v;
+}
+
+// Samples the corner of a coarse block, fills the block with it and marks
+// it as computed, so that the node that refines it starts from scratch
+void ProgressiveRenderer::restart(int ix, int iy) {
+    fill(ix, iy, coarse_step, sample(ix, iy));
+    int ex { std::min(ix + coarse_step, n_x) };
+    int ey { std::min(iy + coarse_step, n_y) };
+    for (int x{ix}; x < ex; x++)
+        for (int y{iy}; y < ey; y++){
+            age[x * n_y + y] = 0;
+            error[x * n_y + y] = 0;
+        }
+}
+
+// Replaces the preview of a coarse block with exact values in one go, so
+// that a block that is cut off by the deadline keeps its preview
+void ProgressiveRenderer::exact(int ix, int iy) {
+    int ex { std::min(ix + coarse_step, n_x) };
+    int ey { std::min(iy + coarse_step, n_y) };
+    RadialInterval interval { rect_radial_interval(
+            xmin + deltax * ix, xmin + deltax * (ex - 1),
+            ymin + deltay * iy, ymin + deltay * (ey - 1)) };
+    bool zero { negligible(n, l, interval, min_normalization) };
+    for (int x{ix}; x < ex; x++)
+        for (int y{iy}; y < ey; y++){
+            if (zero)
+                psi[x * n_y + y] = 0;
+            else
+                sample(x, y);
+            age[x * n_y + y] = 0;
+            error[x * n_y + y] = 0;
+        }
+}
+
+// Builds the image for the current view from the one for the given view
+// and queues the work that makes it exact again
+void ProgressiveRenderer::reproject(const View &from) {
+    using std::abs;
+    std::swap(psi, previous);
+    std::swap(age, previous_age);
+    std::swap(error, previous_error);
+    psi.resize(n_x * n_y);
+    age.resize(n_x * n_y);
+    error.resize(n_x * n_y);
+
+    // Zooming in by more than this blurs the old pixels visibly
+    bool magnified { deltax * max_magnification < from.deltax
+                  || deltay * max_magnification < from.deltay };
+    // Moving off the old plane changes psi about as fast as moving along
+    // it, so the difference between neighbouring old pixels times the
+    // distance in old pixel spacings estimates the error
+    double spacing { std::min(from.deltax, from.deltay) };
+
+    // Position of a new pixel in old pixel units and its distance from the
+    // old plane; all three are affine in the pixel indices
+    auto project = [&](const double car_coord[3], double res[3]){
+        res[0] = res[1] = res[2] = 0;
+        for (int k{0}; k < 3; k++){
+            res[0] += car_coord[k] * from.unit_xp[k] / from.deltax;
+            res[1] += car_coord[k] * from.unit_yp[k] / from.deltay;
+            res[2] += car_coord[k] * from.unit_zp[k];
+        }
+    };
+    double origin[3], step_x[3], step_y[3], car_coord[3];
+    for (int k{0}; k < 3; k++)
+        car_coord[k] = xmin * unit_xp[k] + ymin * unit_yp[k];
+    project(car_coord, origin);
+    origin[0] -= from.xmin / from.deltax;
+    origin[1] -= from.ymin / from.deltay;
+    for (int k{0}; k < 3; k++)
+        car_coord[k] = deltax * unit_xp[k];
+    project(car_coord, step_x);
+    for (int k{0}; k < 3; k++)
+        car_coord[k] = deltay * unit_yp[k];
+    project(car_coord, step_y);
+
+    ThreadPool::global().parallel_for(n_x, [&](int ix){
+        for (int iy{0}; iy < n_y; iy++){
+            int i { ix * n_y + iy };
+            double fx { origin[0] + step_x[0] * ix + step_y[0] * iy };
+            double fy { origin[1] + step_x[1] * ix + step_y[1] * iy };
+            double d { origin[2] + step_x[2] * ix + step_y[2] * iy };
+            if (magnified || !(fx >= 0 && fx <= n_x - 1 && fy >= 0 && fy <= n_y - 1)){
+                psi[i] = 0;
+                age[i] = invalid_age;
+                continue;
+            }
+
+            int x0 { std::min((int)fx, std::max(n_x - 2, 0)) };
+            int y0 { std::min((int)fy, std::max(n_y - 2, 0)) };
+            int x1 { std::min(x0 + 1, n_x - 1) };
+            int y1 { std::min(y0 + 1, n_y - 1) };
+            double wx { fx - x0 }, wy { fy - y0 };
+            int corner[4] { x0 * n_y + y0, x0 * n_y + y1, x1 * n_y + y0, x1 * n_y + y1 };
+            double weight[4] { (1 - wx) * (1 - wy), (1 - wx) * wy, wx * (1 - wy), wx * wy };
+            // The nucleus is not finite, so it is left out of the average
+            // unless the pixel lands on it
+            complexd_t value{0};
+            double total{0};
+            int oldest{0}, nearest{0};
+            double inherited{0};
+            for (int c{0}; c < 4; c++){
+                oldest = std::max(oldest, (int)previous_age[corner[c]]);
+                inherited = std::max(inherited, (double)previous_error[corner[c]]);
+                if (weight[c] > weight[nearest])
+                    nearest = c;
+                if (!std::isfinite(previous[corner[c]].real() + previous[corner[c]].imag()))
+                    continue;
+                value += weight[c] * previous[corner[c]];
+                total += weight[c];
+            }
+            value = total > 0 ? value / total : previous[corner[nearest]];
+            complexd_t along_x { previous[corner[2]] - previous[corner[0]] };
+            complexd_t along_y { previous[corner[1]] - previous[corner[0]] };
+            double slope { std::max(abs(along_x.real()) + abs(along_x.imag()),
+                                    abs(along_y.real()) + abs(along_y.imag())) };
+            double estimate { inherited + (std::isfinite(slope) ? slope : 0) * abs(d) / spacing };
+            if (oldest >= invalid_age - 1){
+                psi[i] = 0;
+                age[i] = invalid_age;
+                continue;
+            }
+            psi[i] = value;
+            age[i] = oldest + 1;
+            error[i] = estimate;
+        }
+    });
+
+    int blocks_x { (n_x + coarse_step - 1) / coarse_step };
+    int blocks_y { (n_y + coarse_step - 1) / coarse_step };
+    need.assign(blocks_x * blocks_y, Keep);
+    ThreadPool::global().parallel_for(blocks_x, [&](int bx){
+        for (int by{0}; by < blocks_y; by++){
+            int cx { bx * coarse_step }, cy { by * coarse_step };
+            int limit { max_age + (bx * 7 + by * 13) % max_age };
+            int ex { std::min(cx + coarse_step, n_x) };
+            int ey { std::min(cy + coarse_step, n_y) };
+            for (int x{cx}; x < ex; x++)
+                for (int y{cy}; y < ey; y++)
+                    if (age[x * n_y + y] > limit || !(error[x * n_y + y] <= tol * scale))
+                        need[bx * blocks_y + by] = std::max(need[bx * blocks_y + by],
+                                age[x * n_y + y] == invalid_age ? Restart : Exact);
+            // A block without a preview gets the same coarse sample as a
+            // fresh start so that it never shows up as a hole
+            if (need[bx * blocks_y + by] == Restart)
+                restart(cx, cy);
+        }
+    });
+
+    urgent.clear();
+    refresh.clear();
+    finishing = false;
+    for (int bx{0}; bx < blocks_x; bx++)
+        for (int by{0}; by < blocks_y; by++){
+            int cx { bx * coarse_step }, cy { by * coarse_step };
+            if (need[bx * blocks_y + by] == Restart)
+                urgent.push_back([this, cx, cy]{ node(cx, cy, coarse_step); });
+            else if (need[bx * blocks_y + by] == Exact)
+                urgent.push_back([this, cx, cy]{ exact(cx, cy); });
+            else
+                refresh.push_back([this, cx, cy]{ exact(cx, cy); });
+        }
+}
@@ -0,0 +1,42 @@
+#include "../headers/quadrature.h"
+
+inline const double pi = 3.141592653589793;
+
+// Nodes and weights of the n-point Gauss-Legendre rule on [a, b], exact
+// for polynomials of degree 2n-1. The roots of P_n are found by Newton
+// iteration from the usual Chebyshev-like initial guesses.
+void gauss_legendre(int n, double a, double b, std::vector<double> &nodes, std::vector<double> &weights){
+    nodes.resize(n);
+    weights.resize(n);
+    gauss_legendre(n, a, b, nodes.data(), weights.data());
+}
+
+// Same, into arrays of n elements
+void gauss_legendre(int n, double a, double b, double *nodes, double *weights){
+    double mid = (a + b) / 2;
+    double half = (b - a) / 2;
+    for (int i{0}; i < (n + 1) / 2; i++){
+        double x = std::cos(pi * (i + 0.75) / (n + 0.5));
+        double dp{0};
+        for (int iter{0}; iter < 100; iter++){
+            // P_n(x) and its derivative by the three term recurrence
+            double p0{1};
+            double p1{x};
+            for (int k{2}; k <= n; k++){
+                double p2 = ((2 * k - 1) * x * p1 - (k - 1) * p0) / k;
+                p0 = p1;
+                p1 = p2;
+            }
+            dp = n * (x * p1 - p0) / (x * x - 1);
+            double dx = p1 / dp;
+            x -= dx;
+            if (std::abs(dx) < 1e-15)
+                break;
+        }
+        double w = 2 / ((1 - x * x) * dp * dp);
+        nodes[i] = mid - half * x;
+        nodes[n - 1 - i] = mid + half * x;
+        weights[i] = half * w;
+        weights[n - 1 - i] = half * w;
+    }
+}
@@ -0,0 +1,63 @@
+#include "../headers/radial.h"
+
+RadialCache::RadialCache() {
+    this->n = 0;
+    this->l = 0;
+    this->xmin = 0;
+    this->xmax = 0;
+    this->ymin = 0;
+    this->ymax = 0;
+    this->n_x = 0;
+    this->n_y = 0;
+    this->deltax = 0;
+    this->deltay = 0;
+    this->symmetric_x = false;
+    this->symmetric_y = false;
+    this->valid = false;
+    this->capacity = 0;
+}
+
+void RadialCache::setState(int n, int l, double xmin, double xmax, double ymin, double ymax,
+                           int n_x, int n_y) {
+    if (valid && n == this->n && l == this->l
+            && xmin == this->xmin && xmax == this->xmax
+            && ymin == this->ymin && ymax == this->ymax
+            && n_x == this->n_x && n_y == this->n_y)
+        return;
+    this->n = n;
+    this->l = l;
+    this->xmin = xmin;
+    this->xmax = xmax;
+    this->ymin = ymin;
+    this->ymax = ymax;
+    this->n_x = n_x;
+    this->n_y = n_y;
+    deltax = (xmax - xmin)/n_x;
+    deltay = (ymax - ymin)/n_y;
+    symmetric_x = symmetric_range(xmin, xmax);
+    symmetric_y = symmetric_range(ymin, ymax);
+    if (n_x * n_y > capacity){
+        capacity = n_x * n_y;
+        values.reset(new std::atomic<double>[capacity]);
+    }
+    for (int i{0}; i < n_x * n_y; i++)
+        values[i].store(NAN, std::memory_order_relaxed);
+    valid = true;
+}
+
+double RadialCache::at(int ix, int iy) {
+    // Mirrored pixels have the same radius and share an entry
+    if (!fundamental(ix, n_x, symmetric_x))
+        ix = n_x - ix;
+    if (!fundamental(iy, n_y, symmetric_y))
+        iy = n_y - iy;
+    std::atomic<double> &slot { values[ix * n_y + iy] };
+    double value { slot.load(std::memory_order_relaxed) };
+    if (std::isnan(value)){
+        double x { xmin + deltax * ix };
+        double y { ymin + deltay * iy };
+        value = Rnl(n, l, std::sqrt(x * x + y * y)).real();
+        slot.store(value, std::memory_order_relaxed);
+    }
+    return value;
+}
@@ -0,0 +1,46 @@
+#include "../headers/resolution.h"
+
+ResolutionController::ResolutionController(int samples, int floor, int ceiling, double target_ms) {
+    this->floor = floor;
+    this->ceiling = std::max(floor, ceiling);
+    this->samples = std::max(this->floor, std::min(this->ceiling, samples));
+    this->target_ms = target_ms;
+    this->average_ms = 0;
+    this->measured = 0;
+}
+
+bool ResolutionController::record(double ms) {
+    average_ms = measured == 0 ? ms : average_ms + 0.2 * (ms - average_ms);
+    measured++;
+    if (measured < settle_frames)
+        return false;
+
+    // Outside of [0.6, 1.25] times the target, aim for 0.8 times it, at
+    // most 30% fewer or 20% more samples per side at once
+    double ratio { average_ms / target_ms };
+    double scale { 1 };
+    if (ratio > 1.25)
+        scale = std::max(0.7, std::sqrt(0.8 / ratio));
+    else if (ratio < 0.6)
+        scale = std::min(1.2, std::sqrt(0.8 / ratio));
+    else
+        return false;
+
+    int next { (int)std::lround(samples * scale / step) * step };
+    if (next == samples)
+        next += scale > 1 ? step : -step;
+    next = std::max(floor, std::min(ceiling, next));
+    if (next == samples)
+        return false;
+    samples = next;
+    measured = 0;
+    return true;
+}
+
+int ResolutionController::size() {
+    return samples;
+}
+
+double ResolutionController::average() {
+    return average_ms;
+}
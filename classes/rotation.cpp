@@ -0,0 +1,150 @@
+#include "../headers/rotation.h"
+
+inline const double pi = 3.141592653589793;
+
+// Coefficients c[m' + l] with Ylm(R u) = sum_m' c[m' + l] Ylm'(u), where R
+// takes the coordinate axes to the given plane basis. They are projections
+// onto the Ylm', done with a quadrature that is exact for degree 2l:
+// Gauss-Legendre in cos(theta) and equally spaced points in phi.
+// The quadrature tables are taken from scratch.
+void rotation_coefficients(int l, int m, const double unit_xp[3], const double unit_yp[3],
+                           const double unit_zp[3], std::vector<complexd_t> &coeffs,
+                           Arena &scratch){
+    using std::sin, std::cos, std::sqrt, std::conj, std::norm;
+    int n_theta { l + 2 };
+    int n_phi { 2 * l + 2 };
+    double *nodes { scratch.take<double>(n_theta) };
+    double *weights { scratch.take<double>(n_theta) };
+    gauss_legendre(n_theta, -1, 1, nodes, weights);
+
+    coeffs.assign(2 * l + 1, 0);
+    double *norms { scratch.take<double>(2 * l + 1) };
+    std::fill(norms, norms + 2 * l + 1, 0.0);
+    for (int i{0}; i < n_theta; i++){
+        double theta { std::acos(nodes[i]) };
+        double rho { sqrt(1 - nodes[i] * nodes[i]) };
+        for (int j{0}; j < n_phi; j++){
+            double phi { 2 * pi * j / n_phi };
+            // The azimuth is atan2(x, y), see spherical_from_cart
+            double u[3] { rho * sin(phi), rho * cos(phi), nodes[i] };
+            double rotated[3] {
+                u[0] * unit_xp[0] + u[1] * unit_yp[0] + u[2] * unit_zp[0],
+                u[0] * unit_xp[1] + u[1] * unit_yp[1] + u[2] * unit_zp[1],
+                u[0] * unit_xp[2] + u[1] * unit_yp[2] + u[2] * unit_zp[2] };
+            double sph[3];
+            spherical_from_cart(rotated, sph);
+            complexd_t value { Ylm(l, m, sph[1], sph[2]) };
+            for (int mp{-l}; mp <= l; mp++){
+                complexd_t y { Ylm(l, mp, theta, phi) };
+                coeffs[mp + l] += weights[i] * value * conj(y);
+                norms[mp + l] += weights[i] * norm(y);
+            }
+        }
+    }
+    for (int k{0}; k < 2 * l + 1; k++)
+        coeffs[k] /= norms[k];
+}
+
+RotatedSlice::RotatedSlice() {
+    this->n = 0;
+    this->l = 0;
+    this->m = 0;
+    this->xmin = 0;
+    this->xmax = 0;
+    this->ymin = 0;
+    this->ymax = 0;
+    this->n_x = 0;
+    this->n_y = 0;
+    this->valid = false;
+    this->built = 0;
+}
+
+// Drops the cached slices unless only m has changed
+void RotatedSlice::setState(int n, int l, int m, double xmin, double xmax,
+                            double ymin, double ymax, int n_x, int n_y) {
+    this->m = m;
+    if (valid && n == this->n && l == this->l
+            && xmin == this->xmin && xmax == this->xmax
+            && ymin == this->ymin && ymax == this->ymax
+            && n_x == this->n_x && n_y == this->n_y)
+        return;
+    this->n = n;
+    this->l = l;
+    this->xmin = xmin;
+    this->xmax = xmax;
+    this->ymin = ymin;
+    this->ymax = ymax;
+    this->n_x = n_x;
+    this->n_y = n_y;
+    basis.resize((size_t)(l + 1) * n_x * n_y);
+    psi.resize(n_x * n_y);
+    radial.setState(n, l, xmin, xmax, ymin, ymax, n_x, n_y);
+    built = 0;
+    valid = true;
+    // Slices left on disk by a previous run with the same view
+    if (DiskCache::global().load(diskKey(), basis.data(), basis.size() * sizeof(complexd_t)))
+        built = l + 1;
+}
+
+CacheKey RotatedSlice::diskKey() {
+    CacheKey key { "rotated slice basis" };
+    key.add(n).add(l).add(xmin).add(xmax).add(ymin).add(ymax).add(n_x).add(n_y);
+    return key;
+}
+
+bool RotatedSlice::ready() {
+    return valid && built == l + 1;
+}
+
+// Computes cached slices until budget_us is used up, at least one
+void RotatedSlice::build(double budget_us) {
+    auto deadline { std::chrono::steady_clock::now()
+        + std::chrono::microseconds((long long)budget_us) };
+    int size { n_x * n_y };
+    double deltax = (xmax - xmin)/n_x;
+    double deltay = (ymax - ymin)/n_y;
+    bool symmetric_x { symmetric_range(xmin, xmax) };
+    bool symmetric_y { symmetric_range(ymin, ymax) };
+    while (valid && built <= l){
+        // The slices only differ in their angular part
+        int mp { -l + 2 * built };
+        complexd_t *slice { basis.data() + (size_t)built * size };
+        ThreadPool::global().parallel_for(n_x, [&](int ix){
+            if (!fundamental(ix, n_x, symmetric_x))
+                return;
+            for (int iy{0}; iy < n_y; iy++){
+                if (!fundamental(iy, n_y, symmetric_y))
+                    continue;
+                double car_coord[3] { xmin + deltax * ix, ymin + deltay * iy, 0 };
+                double sph_coord[3];
+                spherical_from_cart(car_coord, sph_coord);
+                slice[ix * n_y + iy] = radial.at(ix, iy) * Ylm(l, mp, sph_coord[1], sph_coord[2]);
+            }
+        });
+        fill_slice_symmetry(slice, l, mp, 0, n_x, n_y, symmetric_x, symmetric_y);
+        built++;
+        if (built > l)
+            DiskCache::global().storeLater(diskKey(), basis.data(), basis.size() * sizeof(complexd_t));
+        if (std::chrono::steady_clock::now() > deadline)
+            break;
+    }
+}
+
+// The slice at the given camera angles, valid until the next call
+const complexd_t *RotatedSlice::render(double phi_c, double theta_c, Arena &scratch) {
+    double unit_xp[3], unit_yp[3], unit_zp[3];
+    plane_basis(phi_c, theta_c, unit_xp, unit_yp, unit_zp);
+    rotation_coefficients(l, m, unit_xp, unit_yp, unit_zp, coeffs, scratch);
+
+    int size { n_x * n_y };
+    int chunks { std::max(1, std::min(size / 4096, 4 * ThreadPool::global().size())) };
+    ThreadPool::global().parallel_for(chunks, [&](int c){
+        int first { (int)((long long)c * size / chunks) };
+        int last { (int)((long long)(c + 1) * size / chunks) };
+        std::fill(psi.begin() + first, psi.begin() + last, complexd_t{0});
+        for (int k{0}; k <= l; k++)
+            caxpy(coeffs[2 * k], basis.data() + (size_t)k * size + first,
+                  psi.data() + first, last - first);
+    });
+    return psi.data();
+}
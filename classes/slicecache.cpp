@@ -0,0 +1,105 @@
+#include "../headers/slicecache.h"
+
+bool SliceKey::operator==(const SliceKey &other) const {
+    return n == other.n && l == other.l && m == other.m && mode == other.mode
+        && phi_c == other.phi_c && theta_c == other.theta_c
+        && width == other.width && height == other.height
+        && n_x == other.n_x && n_y == other.n_y;
+}
+
+// FNV-1a over the fields, so that padding never enters the hash
+size_t SliceKeyHash::operator()(const SliceKey &key) const {
+    uint64_t hash { fnv1a(&key.n, sizeof(key.n)) };
+    hash = fnv1a(&key.l, sizeof(key.l), hash);
+    hash = fnv1a(&key.m, sizeof(key.m), hash);
+    hash = fnv1a(&key.mode, sizeof(key.mode), hash);
+    hash = fnv1a(&key.phi_c, sizeof(key.phi_c), hash);
+    hash = fnv1a(&key.theta_c, sizeof(key.theta_c), hash);
+    hash = fnv1a(&key.width, sizeof(key.width), hash);
+    hash = fnv1a(&key.height, sizeof(key.height), hash);
+    hash = fnv1a(&key.n_x, sizeof(key.n_x), hash);
+    hash = fnv1a(&key.n_y, sizeof(key.n_y), hash);
+    return (size_t)hash;
+}
+
+// Key of the same image in the disk cache
+CacheKey slice_disk_key(const SliceKey &key) {
+    CacheKey disk { "slice" };
+    disk.add(key.n).add(key.l).add(key.m).add(key.mode)
+        .add(key.phi_c).add(key.theta_c).add(key.width).add(key.height)
+        .add(key.n_x).add(key.n_y);
+    return disk;
+}
+
+SliceCache::SliceCache(size_t capacity_bytes) {
+    this->capacity = capacity_bytes;
+    this->bytes = 0;
+    this->hits = 0;
+    this->misses = 0;
+    this->evictions = 0;
+}
+
+// A smaller cap takes effect at once
+void SliceCache::setCapacity(size_t capacity_bytes) {
+    capacity = capacity_bytes;
+    evict();
+}
+
+size_t SliceCache::getCapacity() {
+    return capacity;
+}
+
+// The cached image of key, n_x * n_y values valid until the next insert,
+// or nullptr. A hit makes the entry the most recently used.
+const complexd_t *SliceCache::find(const SliceKey &key) {
+    auto it = index.find(key);
+    if (it == index.end()){
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->image.data();
+}
+
+bool SliceCache::contains(const SliceKey &key) {
+    return index.count(key) > 0;
+}
+
+// Stores a copy of the n_x * n_y values of psi. Images larger than the
+// whole cap are not kept.
+void SliceCache::insert(const SliceKey &key, const complexd_t *psi) {
+    size_t size { (size_t)key.n_x * key.n_y };
+    size_t entry_bytes { size * sizeof(complexd_t) };
+    auto it = index.find(key);
+    if (it != index.end()){
+        entries.splice(entries.begin(), entries, it->second);
+        return;
+    }
+    if (entry_bytes > capacity)
+        return;
+    entries.push_front({key, std::vector<complexd_t>(psi, psi + size)});
+    index[key] = entries.begin();
+    bytes += entry_bytes;
+    evict();
+}
+
+void SliceCache::clear() {
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+SliceCache::Stats SliceCache::stats() {
+    return { hits, misses, evictions, entries.size(), bytes };
+}
+
+void SliceCache::evict() {
+    while (bytes > capacity && !entries.empty()){
+        const Entry &last { entries.back() };
+        bytes -= last.image.size() * sizeof(complexd_t);
+        index.erase(last.key);
+        entries.pop_back();
+        evictions++;
+    }
+}
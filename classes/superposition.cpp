@@ -0,0 +1,128 @@
+#include "../headers/superposition.h"
+
+// y += a * x for complex arrays of length size.
+// Written out on the real and imaginary parts so that the loop vectorises
+// (complex operator* calls into libgcc to handle inf/nan)
+void caxpy(complexd_t a, const complexd_t *x, complexd_t *y, int size){
+    const double ar {a.real()};
+    const double ai {a.imag()};
+    const double *xd {reinterpret_cast<const double*>(x)};
+    double *yd {reinterpret_cast<double*>(y)};
+    for (int i{0}; i < 2 * size; i += 2){
+        double xr = xd[i];
+        double xi = xd[i + 1];
+        yd[i]     += ar * xr - ai * xi;
+        yd[i + 1] += ar * xi + ai * xr;
+    }
+}
+
+TimeEvolution::TimeEvolution() {
+    this->psi = nullptr;
+    this->phi_c = 0;
+    this->theta_c = 0;
+    this->xmin = 0;
+    this->xmax = 0;
+    this->ymin = 0;
+    this->ymax = 0;
+    this->n_x = 0;
+    this->n_y = 0;
+    this->valid = false;
+    this->image_size = 0;
+}
+
+TimeEvolution::~TimeEvolution() {
+    clearComponents();
+    delete[] psi;
+}
+
+void TimeEvolution::setStates(const std::vector<State> &states) {
+    bool same = states.size() == this->states.size()
+        && std::equal(states.begin(), states.end(), this->states.begin(),
+                [](const State &a, const State &b){
+                    return a.n == b.n && a.l == b.l && a.m == b.m && a.c == b.c;
+                });
+    if (same)
+        return;
+    this->states = states;
+    valid = false;
+}
+
+void TimeEvolution::setView(double phi_c, double theta_c, double xmin, double xmax,
+                            double ymin, double ymax, int n_x, int n_y) {
+    if (phi_c == this->phi_c && theta_c == this->theta_c
+            && xmin == this->xmin && xmax == this->xmax
+            && ymin == this->ymin && ymax == this->ymax
+            && n_x == this->n_x && n_y == this->n_y)
+        return;
+
+    if (n_x * n_y != this->n_x * this->n_y){
+        delete[] psi;
+        psi = new complexd_t[n_x * n_y];
+    }
+    this->phi_c = phi_c;
+    this->theta_c = theta_c;
+    this->xmin = xmin;
+    this->xmax = xmax;
+    this->ymin = ymin;
+    this->ymax = ymax;
+    this->n_x = n_x;
+    this->n_y = n_y;
+    valid = false;
+}
+
+// Returns the superposition at time t (atomic units) on the current view.
+// The buffer is owned by this object and overwritten on the next call.
+complexd_t *TimeEvolution::evolve(double t) {
+    if (!valid)
+        buildComponents();
+
+    int size {n_x * n_y};
+    std::fill(psi, psi + size, complexd_t{0});
+    for (const Component &comp : components)
+        caxpy(std::polar(1.0, -energy(comp.n) * t), comp.image, psi, size);
+    return psi;
+}
+
+void TimeEvolution::clearComponents() {
+    for (Component &comp : components)
+        delete[] comp.image;
+    components.clear();
+}
+
+void TimeEvolution::buildComponents() {
+    int size {n_x * n_y};
+    // While only the view changes the components stay the same and their
+    // images are overwritten in place
+    auto has_component = [&](int n){
+        return std::any_of(components.begin(), components.end(),
+                [&](const Component &comp){ return comp.n == n; });
+    };
+    auto has_state = [&](const Component &comp){
+        return std::any_of(states.begin(), states.end(),
+                [&](const State &s){ return s.n == comp.n; });
+    };
+    bool reuse { size == image_size
+        && std::all_of(states.begin(), states.end(), [&](const State &s){ return has_component(s.n); })
+        && std::all_of(components.begin(), components.end(), has_state) };
+    if (reuse){
+        for (Component &comp : components)
+            std::fill(comp.image, comp.image + size, complexd_t{0});
+    }
+    else {
+        clearComponents();
+        image_size = size;
+    }
+    term.resize(size);
+    for (const State &s : states){
+        auto it = std::find_if(components.begin(), components.end(),
+                [&](const Component &comp){ return comp.n == s.n; });
+        if (it == components.end()){
+            components.push_back({s.n, new complexd_t[size]{}});
+            it = components.end() - 1;
+        }
+        get_psi(s.n, s.l, s.m, phi_c, theta_c,
+                xmin, xmax, ymin, ymax, n_x, n_y, term.data());
+        caxpy(s.c, term.data(), it->image, size);
+    }
+    valid = true;
+}
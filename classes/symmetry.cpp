@@ -0,0 +1,66 @@
+#include "../headers/symmetry.h"
+
+inline const double pi = 3.141592653589793;
+
+bool symmetric_range(double min, double max){
+    return min == -max;
+}
+
+// Whether point i of an axis with n points has to be evaluated
+bool fundamental(int i, int n, bool symmetric){
+    return !symmetric || i == 0 || 2 * i >= n;
+}
+
+// Fills the pixels that fundamental() skipped from their mirror images
+void fill_slice_symmetry(complexd_t *psi, int l, int m, double phi_c, int n_x, int n_y,
+                         bool symmetric_x, bool symmetric_y){
+    double parity { l % 2 == 0 ? 1.0 : -1.0 };
+    complexd_t mirror { std::polar(1.0, m * (pi - 2 * phi_c)) };
+    ThreadPool::global().parallel_for(n_x, [&](int ix){
+        bool copy_x { !fundamental(ix, n_x, symmetric_x) };
+        for (int iy{0}; iy < n_y; iy++){
+            bool copy_y { !fundamental(iy, n_y, symmetric_y) };
+            if (!copy_x && !copy_y)
+                continue;
+            int sx { copy_x ? n_x - ix : ix };
+            int sy { copy_y ? n_y - iy : iy };
+            complexd_t source { psi[sx * n_y + sy] };
+            // (-x, -y) is parity, (x, -y) the mirror and (-x, y) both
+            if (copy_x && copy_y)
+                psi[ix * n_y + iy] = parity * source;
+            else if (copy_y)
+                psi[ix * n_y + iy] = mirror * std::conj(source);
+            else
+                psi[ix * n_y + iy] = parity * mirror * std::conj(source);
+        }
+    });
+}
+
+// Fills the points of a size^3 volume in get_volume's order (x fastest)
+// that fundamental() skipped from their mirror images
+void fill_volume_symmetry(complexd_t *vol, int l, int m, int size){
+    double sign_y { m % 2 == 0 ? 1.0 : -1.0 };
+    double sign_z { (l + m) % 2 == 0 ? 1.0 : -1.0 };
+    ThreadPool::global().parallel_for(size, [&](int k){
+        bool copy_z { !fundamental(k, size) };
+        for (int j{0}; j < size; j++){
+            bool copy_y { !fundamental(j, size) };
+            for (int i{0}; i < size; i++){
+                bool copy_x { !fundamental(i, size) };
+                if (!copy_x && !copy_y && !copy_z)
+                    continue;
+                int si { copy_x ? size - i : i };
+                int sj { copy_y ? size - j : j };
+                int sk { copy_z ? size - k : k };
+                complexd_t value { vol[((size_t)sk * size + sj) * size + si] };
+                if (copy_z)
+                    value *= sign_z;
+                if (copy_y)
+                    value = sign_y * std::conj(value);
+                if (copy_x)
+                    value = std::conj(value);
+                vol[((size_t)k * size + j) * size + i] = value;
+            }
+        }
+    });
+}
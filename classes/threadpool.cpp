@@ -0,0 +1,269 @@
+#include "../headers/threadpool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Set on pool workers so that loops nested inside a loop run serially
+// instead of waiting on the pool they are running on
+static thread_local bool in_pool = false;
+
+// 0 on threads that call into a pool, the worker number on pool workers
+static thread_local int worker_index = 0;
+
+// Queue that spawn() pushes to while a thread is running a task of run_tasks
+static thread_local ThreadPool *task_pool = nullptr;
+static thread_local int task_slot = 0;
+
+ThreadPool::ThreadPool(int threads, bool pin) {
+    this->body = nullptr;
+    this->count = 0;
+    this->next = 0;
+    this->busy = 0;
+    this->generation = 0;
+    this->stop = false;
+    this->pending = 0;
+    start(threads, pin);
+}
+
+ThreadPool::~ThreadPool() {
+    shutdown();
+}
+
+// Pool shared by the renderers, one thread per hardware thread
+ThreadPool &ThreadPool::global() {
+    static ThreadPool pool;
+    return pool;
+}
+
+int ThreadPool::size() {
+    return (int)workers.size() + 1;
+}
+
+// Index of the calling thread among the threads that run a loop of the
+// pool, from 0 to size() - 1, so that per-thread scratch can be looked up
+int ThreadPool::thread_index() {
+    return worker_index;
+}
+
+// From now on loops started by the calling thread run on it alone, for
+// background threads that must never hold up the loops of the render thread
+void ThreadPool::run_loops_inline() {
+    in_pool = true;
+}
+
+// Gives the calling thread the lowest priority, for background threads
+// that only use what the render thread leaves over
+void ThreadPool::lower_priority() {
+#ifdef __linux__
+    // Nice only applies to the calling thread on Linux
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#endif
+}
+
+// threads <= 0 means one per hardware thread. With pin set, worker i is
+// bound to core i+1, leaving core 0 to the calling (render) thread.
+void ThreadPool::resize(int threads, bool pin) {
+    std::lock_guard<std::mutex> guard(submit);
+    shutdown();
+    start(threads, pin);
+}
+
+void ThreadPool::start(int threads, bool pin) {
+    if (threads <= 0)
+        threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    stop = false;
+    queues.clear();
+    for (int i{0}; i < threads; i++)
+        queues.push_back(std::make_unique<TaskQueue>());
+    for (int i{1}; i < threads; i++)
+        workers.emplace_back(&ThreadPool::work, this, i, pin);
+}
+
+void ThreadPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (std::thread &w : workers)
+        w.join();
+    workers.clear();
+}
+
+void ThreadPool::work(int index, bool pin) {
+#ifdef __linux__
+    if (pin){
+        int cores { (int)std::max(1u, std::thread::hardware_concurrency()) };
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % cores, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#else
+    (void)index;
+    (void)pin;
+#endif
+    in_pool = true;
+    worker_index = index;
+    unsigned long seen {0};
+    while (true){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]{ return stop || generation != seen; });
+            if (stop)
+                return;
+            seen = generation;
+        }
+        runItems();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                finished.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runItems() {
+    int i;
+    while ((i = next.fetch_add(1)) < count)
+        (*body)(i);
+}
+
+void ThreadPool::loop(int count, const std::function<void(int)> &body) {
+    if (count <= 0)
+        return;
+    if (in_pool || workers.empty() || count == 1){
+        for (int i{0}; i < count; i++)
+            body(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(submit);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->body = &body;
+        this->count = count;
+        this->next = 0;
+        this->busy = (int)workers.size();
+        this->generation++;
+    }
+    wake.notify_all();
+
+    in_pool = true;
+    runItems();
+    in_pool = false;
+
+    // Every worker has to check in before body goes out of scope
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&]{ return busy == 0; });
+    this->body = nullptr;
+}
+
+// Runs tasks, and every task they spawn, until none are left or the
+// deadline has passed. Tasks that were not started by the deadline are
+// put back into tasks so that the caller can resume them later.
+// Must not be called from inside a pool task.
+void ThreadPool::run_tasks(std::vector<Task> &tasks, Clock::time_point deadline) {
+    std::lock_guard<std::mutex> guard(submit);
+    int slots { (int)queues.size() };
+    for (size_t i{0}; i < tasks.size(); i++)
+        queues[i % slots]->tasks.push_back(std::move(tasks[i]));
+    pending = (int)tasks.size();
+    tasks.clear();
+    this->deadline = deadline;
+
+    // One steal loop per thread; the slot doubles as the queue index
+    std::function<void(int)> steal { [this](int slot){ stealLoop(slot); } };
+    if (workers.empty()){
+        stealLoop(0);
+    }
+    else {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->body = &steal;
+            this->count = slots;
+            this->next = 0;
+            this->busy = (int)workers.size();
+            this->generation++;
+        }
+        wake.notify_all();
+        in_pool = true;
+        runItems();
+        in_pool = false;
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]{ return busy == 0; });
+        this->body = nullptr;
+    }
+
+    for (std::unique_ptr<TaskQueue> &q : queues){
+        for (size_t i{q->head}; i < q->tasks.size(); i++)
+            tasks.push_back(q->tasks[i]);
+        q->tasks.clear();
+        q->head = 0;
+    }
+}
+
+// Adds a task to the queue of the calling thread. Only valid from inside
+// a task that is being run by run_tasks.
+void ThreadPool::spawn(Task task) {
+    ThreadPool *pool { task_pool };
+    pool->pending++;
+    std::lock_guard<std::mutex> lock(pool->queues[task_slot]->mutex);
+    pool->queues[task_slot]->tasks.push_back(std::move(task));
+}
+
+// Newest task of our own queue, or else the oldest of somebody else's
+bool ThreadPool::popTask(int slot, Task &task) {
+    {
+        TaskQueue &own { *queues[slot] };
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.tasks.size() > own.head){
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            if (own.tasks.size() == own.head){
+                own.tasks.clear();
+                own.head = 0;
+            }
+            return true;
+        }
+    }
+    int slots { (int)queues.size() };
+    for (int i{1}; i < slots; i++){
+        TaskQueue &victim { *queues[(slot + i) % slots] };
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.size() > victim.head){
+            task = victim.tasks[victim.head++];
+            if (victim.tasks.size() == victim.head){
+                victim.tasks.clear();
+                victim.head = 0;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::stealLoop(int slot) {
+    ThreadPool *outer_pool { task_pool };
+    int outer_slot { task_slot };
+    task_pool = this;
+    task_slot = slot;
+    Task task;
+    while (pending > 0 && Clock::now() < deadline){
+        if (!popTask(slot, task)){
+            // Everything left is running and may still spawn more
+            std::this_thread::yield();
+            continue;
+        }
+        task();
+        task = nullptr;
+        pending--;
+    }
+    task_pool = outer_pool;
+    task_slot = outer_slot;
+}
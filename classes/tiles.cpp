@@ -0,0 +1,191 @@
+#include "../headers/tiles.h"
+
+bool TileKey::operator==(const TileKey &other) const {
+    return n == other.n && l == other.l && m == other.m
+        && phi_c == other.phi_c && theta_c == other.theta_c
+        && level == other.level && tx == other.tx && ty == other.ty;
+}
+
+// FNV-1a over the fields, so that padding never enters the hash
+size_t TileKeyHash::operator()(const TileKey &key) const {
+    uint64_t hash { fnv1a(&key.n, sizeof(key.n)) };
+    hash = fnv1a(&key.l, sizeof(key.l), hash);
+    hash = fnv1a(&key.m, sizeof(key.m), hash);
+    hash = fnv1a(&key.phi_c, sizeof(key.phi_c), hash);
+    hash = fnv1a(&key.theta_c, sizeof(key.theta_c), hash);
+    hash = fnv1a(&key.level, sizeof(key.level), hash);
+    hash = fnv1a(&key.tx, sizeof(key.tx), hash);
+    hash = fnv1a(&key.ty, sizeof(key.ty), hash);
+    return (size_t)hash;
+}
+
+TilePyramid::TilePyramid(size_t capacity_bytes) {
+    this->n = 0;
+    this->l = 0;
+    this->m = 0;
+    this->phi_c = 0;
+    this->theta_c = 0;
+    this->done = false;
+    this->capacity = capacity_bytes;
+}
+
+// Tiles of other states stay cached until they are the least recently used
+void TilePyramid::setState(int n, int l, int m, double phi_c, double theta_c) {
+    if (n == this->n && l == this->l && m == this->m
+            && phi_c == this->phi_c && theta_c == this->theta_c)
+        return;
+    this->n = n;
+    this->l = l;
+    this->m = m;
+    this->phi_c = phi_c;
+    this->theta_c = theta_c;
+    done = false;
+}
+
+// Draws the view into psi, n_x * n_y values in get_psi's order. Visible
+// tiles that are missing are rendered first; once the budget is spent the
+// rest are drawn from a coarser level that is cached, if there is one.
+// The time left goes to the tiles of the next level in. Returns whether
+// any visible tile was rendered.
+bool TilePyramid::render(double xmin, double xmax, double ymin, double ymax, int n_x, int n_y,
+                         complexd_t *psi, double budget_us) {
+    auto deadline { std::chrono::steady_clock::now()
+        + std::chrono::microseconds((long long)budget_us) };
+    auto in_budget = [&]{ return std::chrono::steady_clock::now() < deadline; };
+    const int T { tile_samples };
+    double deltax = (xmax - xmin)/n_x;
+    double deltay = (ymax - ymin)/n_y;
+    int level { levelFor(std::max(deltax, deltay)) };
+    double side { std::ldexp(base_size, -level) };
+    double spacing { side / T };
+    int tx0 { (int)std::floor(xmin / side) };
+    int tx1 { (int)std::floor((xmin + deltax * (n_x - 1)) / side) };
+    int ty0 { (int)std::floor(ymin / side) };
+    int ty1 { (int)std::floor((ymin + deltay * (n_y - 1)) / side) };
+    int cols { tx1 - tx0 + 1 };
+    int rows { ty1 - ty0 + 1 };
+
+    bool rendered { false };
+    bool missing { false };
+    for (int tx{tx0}; tx <= tx1; tx++){
+        for (int ty{ty0}; ty <= ty1; ty++){
+            if (index.count(key(level, tx, ty)))
+                continue;
+            double mid[2] { (tx + 0.5) * side, (ty + 0.5) * side };
+            if (in_budget() || !coarser(level, mid[0], mid[1]))
+                rendered = build(level, tx, ty) || rendered;
+            else
+                missing = true;
+        }
+    }
+    // Only collected now, since building may evict
+    visible.assign((size_t)cols * rows, nullptr);
+    for (int tx{tx0}; tx <= tx1; tx++)
+        for (int ty{ty0}; ty <= ty1; ty++)
+            visible[(tx - tx0) * rows + (ty - ty0)] = find(level, tx, ty);
+
+    for (int ix{0}; ix < n_x; ix++){
+        double x { xmin + deltax * ix };
+        long long gx { (long long)std::floor(x / spacing) };
+        int i { (int)(((gx % T) + T) % T) };
+        int tx { (int)((gx - i) / T) };
+        for (int iy{0}; iy < n_y; iy++){
+            double y { ymin + deltay * iy };
+            long long gy { (long long)std::floor(y / spacing) };
+            int j { (int)(((gy % T) + T) % T) };
+            int ty { (int)((gy - j) / T) };
+            bool inside { tx >= tx0 && tx <= tx1 && ty >= ty0 && ty <= ty1 };
+            const complexd_t *tile { inside ? visible[(tx - tx0) * rows + (ty - ty0)] : nullptr };
+            const complexd_t *value { tile ? tile + i * T + j : coarser(level, x, y) };
+            psi[ix * n_y + iy] = value ? *value : complexd_t{0};
+        }
+    }
+
+    // One level ahead, for zooming in
+    bool ahead { true };
+    if (!missing){
+        for (int tx{2 * tx0}; tx <= 2 * tx1 + 1 && ahead; tx++){
+            for (int ty{2 * ty0}; ty <= 2 * ty1 + 1; ty++){
+                if (index.count(key(level + 1, tx, ty)))
+                    continue;
+                if (!in_budget()){
+                    ahead = false;
+                    break;
+                }
+                build(level + 1, tx, ty);
+            }
+        }
+    }
+    done = !missing && ahead;
+    return rendered;
+}
+
+bool TilePyramid::complete() {
+    return done;
+}
+
+size_t TilePyramid::tileCount() {
+    return tiles.size();
+}
+
+// The level whose sample spacing is at most the given one, and more than
+// half of it
+int TilePyramid::levelFor(double spacing) {
+    return (int)std::ceil(std::log2(base_size / (tile_samples * spacing)) - 1e-9);
+}
+
+TileKey TilePyramid::key(int level, int tx, int ty) {
+    return { n, l, m, phi_c, theta_c, level, tx, ty };
+}
+
+// The samples of a cached tile, which becomes the most recently used, or null
+const complexd_t *TilePyramid::find(int level, int tx, int ty) {
+    auto it = index.find(key(level, tx, ty));
+    if (it == index.end())
+        return nullptr;
+    tiles.splice(tiles.begin(), tiles, it->second);
+    return it->second->samples.data();
+}
+
+// Renders a tile into the cache, in the storage of the least recently
+// used one once the cache is full. Returns whether it was missing.
+bool TilePyramid::build(int level, int tx, int ty) {
+    TileKey k { key(level, tx, ty) };
+    if (index.count(k))
+        return false;
+    const int T { tile_samples };
+    size_t tile_bytes { (size_t)T * T * sizeof(complexd_t) };
+    if (!tiles.empty() && (tiles.size() + 1) * tile_bytes > capacity){
+        index.erase(tiles.back().key);
+        tiles.splice(tiles.begin(), tiles, std::prev(tiles.end()));
+    }
+    else {
+        tiles.push_front({ k, std::vector<complexd_t>((size_t)T * T) });
+    }
+    Tile &tile { tiles.front() };
+    tile.key = k;
+    index[k] = tiles.begin();
+
+    // Samples at the centres of the cells of the tile
+    double side { std::ldexp(base_size, -level) };
+    double x0 { tx * side + side / T / 2 };
+    double y0 { ty * side + side / T / 2 };
+    get_psi(n, l, m, phi_c, theta_c, x0, x0 + side, y0, y0 + side, T, T, tile.samples.data());
+    return true;
+}
+
+// Nearest sample of a cached tile up to four levels out, or null
+const complexd_t *TilePyramid::coarser(int level, double x, double y) {
+    const int T { tile_samples };
+    for (int up{level - 1}; up >= level - 4; up--){
+        double spacing { std::ldexp(base_size, -up) / T };
+        long long gx { (long long)std::floor(x / spacing) };
+        long long gy { (long long)std::floor(y / spacing) };
+        int i { (int)(((gx % T) + T) % T) };
+        int j { (int)(((gy % T) + T) % T) };
+        auto it = index.find(key(up, (int)((gx - i) / T), (int)((gy - j) / T)));
+        if (it != index.end())
+            return it->second->samples.data() + i * T + j;
+    }
+    return nullptr;
+}
@@ -1,7 +1,15 @@
 #include "../headers/wavefunction.h"
+#include "../headers/bounds.h"
+#include "../headers/threadpool.h"
+#include "../headers/symmetry.h"
 
 inline const double pi = 3.141592653589793;
 
+// Side length in pixels of the tiles that are handed to the thread pool
+// and culled as a whole when their bound on |psi| is below the display
+// threshold. 16x16 RGBA doubles are 8 KiB, well inside L1.
+static const int cull_tile = 16;
+
 
 // Returns (i + j)!/(i - j)!
 // assumes that i > abs(j)
@@ -21,6 +29,11 @@ int prod(int i, int j){
     return cumProd;
 }
 
+// Energy of level n in Hartree (atomic units, E_1 = -1/2)
+double energy(int n){
+    return -0.5 / (n * n);
+}
+
 // Convention: theta is polar angle and phi is azimuthal. 
 complexd_t Ylm(int l, int m, double theta, double phi){
     using std::sqrt, std::abs, std::polar, std::assoc_legendre, std::cos;
@@ -32,7 +45,7 @@ complexd_t Ylm(int l, int m, double theta, double phi){
 
 complexd_t Rnl(int n, int l, double r){
     using std::sqrt, std::pow, std::exp, std::assoc_laguerre;
-    double a = 0.529e-10;
+    double a = a0;
     complexd_t c = sqrt(pow(2 / (n * a), 3)
             * fracfac(n, l) / ((n-l) * (2 * n)))
             * exp( -r / (n*a))
@@ -41,6 +54,68 @@ complexd_t Rnl(int n, int l, double r){
     return c;
 }
 
+// Upper bound on |Rnl(r)|: the Laguerre polynomial with the absolute
+// values of its coefficients, times the same prefactor and exponential.
+// L_k^a(x) = sum_i (-1)^i (k+a choose k-i) x^i / i!
+double Rnl_envelope(int n, int l, double r){
+    return Rnl_bound(n, l, r, r);
+}
+
+// Upper bound on |Rnl(r)| for r_min <= r <= r_max. Every factor of the
+// envelope except the exponential is increasing in r, so evaluating those
+// at r_max and the exponential at r_min is conservative.
+double Rnl_bound(int n, int l, double r_min, double r_max){
+    using std::sqrt, std::pow, std::exp;
+    double a = a0;
+    double x_min = 2*r_min/(n*a);
+    double x = 2*r_max/(n*a);
+    int k = n - l - 1;
+    double poly{0};
+    double xi{1};
+    double ifac{1};
+    for (int i{0}; i <= k; i++){
+        // (n+l choose k-i) computed as a product to stay in doubles
+        double binom{1};
+        for (int j{1}; j <= k - i; j++)
+            binom *= (double)(2*l + 1 + i + j) / j;
+        poly += binom * xi / ifac;
+        xi *= x;
+        ifac *= i + 1;
+    }
+    return sqrt(pow(2 / (n * a), 3)
+            * fracfac(n, l) / ((n-l) * (2 * n)))
+            * exp(-x_min / 2)
+            * pow(x, l)
+            * poly;
+}
+
+// Upper bound on |Ylm| over the sphere. By Unsold's theorem
+// sum_m |Ylm|^2 = (2l+1)/4pi, so no single term can exceed it.
+double Ylm_bound(int l){
+    return std::sqrt((2 * l + 1) / (4 * pi));
+}
+
+// Radius beyond which |psi_nlm| < tol for every m.
+// The envelope is e^(-x/2) times a polynomial of degree n-1 with positive
+// coefficients, so it is decreasing for x = 2r/(na) > 2(n-1).
+double radial_cutoff(int n, int l, double tol){
+    double r_lo = (n - 1) * n * a0;
+    double ybound = Ylm_bound(l);
+    if (Rnl_envelope(n, l, r_lo) * ybound < tol)
+        return r_lo;
+    double r_hi = 2 * r_lo + n * a0;
+    while (Rnl_envelope(n, l, r_hi) * ybound >= tol)
+        r_hi *= 2;
+    for (int i{0}; i < 50; i++){
+        double mid = (r_lo + r_hi) / 2;
+        if (Rnl_envelope(n, l, mid) * ybound >= tol)
+            r_lo = mid;
+        else
+            r_hi = mid;
+    }
+    return r_hi;
+}
+
 complexd_t psi_nlm(int n, int l, int m, double r, double theta, double phi){
     return Rnl(n, l, r) * Ylm(l, m, theta, phi);
     //return Ylm(l, m, theta, phi);
@@ -56,12 +131,12 @@ void linspace(double start, double stop, int n, double* array){
 
 complexd_t* psi_arr(int n, int l, int m, Dims dims){
 
-    double phi[dims.phi];
-    double theta[dims.theta];
-    double r[dims.r];
-    linspace(0, 2*pi, dims.phi, phi);
-    linspace(0, pi, dims.theta, theta);
-    linspace(0, 1, dims.r, r);
+    std::vector<double> phi(dims.phi);
+    std::vector<double> theta(dims.theta);
+    std::vector<double> r(dims.r);
+    linspace(0, 2*pi, dims.phi, phi.data());
+    linspace(0, pi, dims.theta, theta.data());
+    linspace(0, 1, dims.r, r.data());
 
 
     int size { dims.r * dims.theta * dims.phi };
@@ -73,15 +148,17 @@ complexd_t* psi_arr(int n, int l, int m, Dims dims){
         std::cout << "Could not allocate memory";
     }
 
-    complexd_t *iter {psi};
-    for (int index {0}; index < size; index++){
-        int i = index % dims.r;
-        int j = (index / dims.r) % dims.theta;
-        int k = index / (dims.r * dims.theta);
-        *iter = psi_nlm(n, l, m, r[i], theta[j], phi[k]);
-        iter++;
-    }
-        
+    // One task per phi slice
+    ThreadPool::global().parallel_for(dims.phi, [&](int k){
+        complexd_t *iter {psi + k * dims.r * dims.theta};
+        for (int j{0}; j < dims.theta; j++){
+            for (int i{0}; i < dims.r; i++){
+                *iter = psi_nlm(n, l, m, r[i], theta[j], phi[k]);
+                iter++;
+            }
+        }
+    });
+
     return psi;
 }
 
@@ -128,14 +205,35 @@ void complex_to_color(complexd_t c, double *col_arr){
 
 
 
-double *get_colors(int n, int l, int m, double phi_c, double theta_c, 
+// Colour of one pixel in each output format: RGBA doubles, RGB floats
+// (the colour attribute of a vertex) or RGBA bytes, clamped to [0, 1]
+static void store_color(const double col[3], double *out){
+    out[0] = col[0];
+    out[1] = col[1];
+    out[2] = col[2];
+    out[3] = 1.0;
+}
+static void store_color(const double col[3], float *out){
+    out[0] = (float)col[0];
+    out[1] = (float)col[1];
+    out[2] = (float)col[2];
+}
+static void store_color(const double col[3], unsigned char *out){
+    for (int k{0}; k < 3; k++)
+        out[k] = (unsigned char)(std::min(1.0, std::max(0.0, col[k])) * 255 + 0.5);
+    out[3] = 255;
+}
+
+// Colours of the slice seen by a camera pointing in azimuth phi_c and
+// polar angle theta_c, written straight into out in its format
+template <typename T>
+static void color_slice(int n, int l, int m, double phi_c, double theta_c,
                double xmin, double xmax, double ymin, double ymax,
-               int n_x, int n_y, double normalization_const){
+               int n_x, int n_y, OutputSpan<T> out, double normalization_const){
     // n, l, m are the arguments for the wave function
     // phi_c and theta_c are the azimuth and polar angle that the 
     // camera is pointing in
     using std::sin, std::cos, std::real, std::imag, std::abs;
-    int size {n_x * n_y * 4};
     double deltax = (xmax - xmin)/n_x;
     double deltay = (ymax - ymin)/n_y;
 
@@ -150,41 +248,176 @@ double *get_colors(int n, int l, int m, double phi_c, double theta_c,
                       sin(phi_c)*sin(theta_c),
                       cos(theta_c)};
 
-    double *colors { new double[size] };
-    double *itercol {colors};
-    double maximum_psi{0};
-    for (int i{0}; i < size/4; i++){
-        // Calculate x and y
-        double x_p = xmin + deltax * (int)(i / n_y);
-        double y_p = ymin + deltay * (i % n_y);
-        // Calculate r, theta and phi
-        double p_coord[3] { x_p, y_p, 0 };
-        double car_coord[3];
-        convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
-        double sph_coord[3];
-        spherical_from_cart(car_coord, sph_coord);
-
-        complexd_t psi = psi_nlm(n, l, m, sph_coord[0],
-                                 sph_coord[1], sph_coord[2]);
-        double col[3];
-        complex_to_color(psi, col);
-        *(itercol++) = col[0];
-        *(itercol++) = col[1];
-        *(itercol++) = col[2];
-        *(itercol++) = 1.0;
+    // Only a quarter of a centred slice is evaluated, see symmetry.h; the
+    // colours are taken after the rest has been filled in
+    bool symmetric_x { symmetric_range(xmin, xmax) };
+    bool symmetric_y { symmetric_range(ymin, ymax) };
+    std::vector<complexd_t> psi(n_x * n_y);
+    ThreadPool::global().parallel_for_tiles(n_x, n_y, cull_tile, cull_tile,
+            [&](int tx, int ex, int ty, int ey){
+        RadialInterval interval { rect_radial_interval(
+                xmin + deltax * tx, xmin + deltax * (ex - 1),
+                ymin + deltay * ty, ymin + deltay * (ey - 1)) };
+        bool skip { negligible(n, l, interval, normalization_const) };
+
+        for (int ix{tx}; ix < ex; ix++){
+            if (!fundamental(ix, n_x, symmetric_x))
+                continue;
+            for (int iy{ty}; iy < ey; iy++){
+                if (!fundamental(iy, n_y, symmetric_y))
+                    continue;
+                if (skip){
+                    psi[ix * n_y + iy] = 0;
+                    continue;
+                }
+                // Calculate x and y
+                double x_p = xmin + deltax * ix;
+                double y_p = ymin + deltay * iy;
+                // Calculate r, theta and phi
+                double p_coord[3] { x_p, y_p, 0 };
+                double car_coord[3];
+                convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
+                double sph_coord[3];
+                spherical_from_cart(car_coord, sph_coord);
+
+                psi[ix * n_y + iy] = psi_nlm(n, l, m, sph_coord[0],
+                                             sph_coord[1], sph_coord[2]);
+            }
+        }
+    });
+    fill_slice_symmetry(psi.data(), l, m, phi_c, n_x, n_y, symmetric_x, symmetric_y);
+    ThreadPool::global().parallel_for(n_x, [&](int ix){
+        for (int iy{0}; iy < n_y; iy++){
+            double col[3];
+            complex_to_color(psi[ix * n_y + iy], col);
+            for (int k{0}; k < 3; k++)
+                col[k] /= normalization_const;
+            store_color(col, out.pixel(ix * n_y + iy));
+        }
+    });
+}
 
-        if (abs(psi) > maximum_psi)
-            maximum_psi = abs(psi);
-    }
-    itercol = colors;
-    for (int i{0}; i < size/4; i++){
-        *(itercol++) /= normalization_const;
-        *(itercol++) /= normalization_const;
-        *(itercol++) /= normalization_const;
-        itercol++;
-    }
+double *get_colors(int n, int l, int m, double phi_c, double theta_c, 
+               double xmin, double xmax, double ymin, double ymax,
+               int n_x, int n_y, double normalization_const){
+    double *colors { new double[n_x * n_y * 4] };
+    color_slice(n, l, m, phi_c, theta_c, xmin, xmax, ymin, ymax, n_x, n_y,
+                OutputSpan<double>{colors, 4}, normalization_const);
+    return colors;
+}
 
-    return colors;    
+// Same colours as RGB floats into a caller's strided buffer, e.g. the
+// colour attribute of interleaved vertices
+void get_colors(int n, int l, int m, double phi_c, double theta_c,
+               double xmin, double xmax, double ymin, double ymax,
+               int n_x, int n_y, OutputSpan<float> rgb, double normalization_const){
+    color_slice(n, l, m, phi_c, theta_c, xmin, xmax, ymin, ymax, n_x, n_y,
+                rgb, normalization_const);
+}
+
+// Same colours as packed RGBA bytes, e.g. for a texture or an image file
+void get_colors(int n, int l, int m, double phi_c, double theta_c,
+               double xmin, double xmax, double ymin, double ymax,
+               int n_x, int n_y, OutputSpan<unsigned char> rgba8, double normalization_const){
+    color_slice(n, l, m, phi_c, theta_c, xmin, xmax, ymin, ymax, n_x, n_y,
+                rgba8, normalization_const);
+}
+
+// Writes a complex image as (Re psi, Im psi, 0) floats, the raw values
+// that fShader1.frag turns into colours
+void store_psi(const complexd_t *psi, int size, OutputSpan<float> out){
+    int chunks { std::max(1, std::min(size / 4096, 4 * ThreadPool::global().size())) };
+    ThreadPool::global().parallel_for(chunks, [&](int c){
+        int first { (int)((long long)c * size / chunks) };
+        int last { (int)((long long)(c + 1) * size / chunks) };
+        for (int i{first}; i < last; i++){
+            float *p { out.pixel(i) };
+            p[0] = (float)psi[i].real();
+            p[1] = (float)psi[i].imag();
+            p[2] = 0.0f;
+        }
+    });
+}
+
+// Returns psi_nlm sampled on the plane through the origin whose normal
+// has azimuth phi_c and polar angle theta_c. Same pixel order as get_colors.
+complexd_t *get_psi(int n, int l, int m, double phi_c, double theta_c,
+               double xmin, double xmax, double ymin, double ymax,
+               int n_x, int n_y){
+    complexd_t *psi { new complexd_t[n_x * n_y] };
+    get_psi(n, l, m, phi_c, theta_c, xmin, xmax, ymin, ymax, n_x, n_y, psi);
+    return psi;
+}
+
+// Same, into a caller's buffer of n_x * n_y values
+void get_psi(int n, int l, int m, double phi_c, double theta_c,
+             double xmin, double xmax, double ymin, double ymax,
+             int n_x, int n_y, complexd_t *psi){
+    double deltax = (xmax - xmin)/n_x;
+    double deltay = (ymax - ymin)/n_y;
+
+    double unit_xp[3], unit_yp[3], unit_zp[3];
+    plane_basis(phi_c, theta_c, unit_xp, unit_yp, unit_zp);
+
+    // Only a quarter of a centred slice is evaluated, see symmetry.h
+    bool symmetric_x { symmetric_range(xmin, xmax) };
+    bool symmetric_y { symmetric_range(ymin, ymax) };
+    ThreadPool::global().parallel_for_tiles(n_x, n_y, cull_tile, cull_tile,
+            [&](int tx, int ex, int ty, int ey){
+        for (int ix{tx}; ix < ex; ix++){
+            if (!fundamental(ix, n_x, symmetric_x))
+                continue;
+            for (int iy{ty}; iy < ey; iy++){
+                if (!fundamental(iy, n_y, symmetric_y))
+                    continue;
+                double p_coord[3] { xmin + deltax * ix, ymin + deltay * iy, 0 };
+                double car_coord[3];
+                convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
+                double sph_coord[3];
+                spherical_from_cart(car_coord, sph_coord);
+
+                psi[ix * n_y + iy] = psi_nlm(n, l, m, sph_coord[0], sph_coord[1], sph_coord[2]);
+            }
+        }
+    });
+    fill_slice_symmetry(psi, l, m, phi_c, n_x, n_y, symmetric_x, symmetric_y);
+}
+
+// Basis vectors (in normal cartesian coords) for the plane seen by a
+// camera pointing in azimuth phi_c and polar angle theta_c
+void plane_basis(double phi_c, double theta_c,
+                 double unit_xp[3], double unit_yp[3], double unit_zp[3]){
+    using std::sin, std::cos;
+    unit_xp[0] = cos(phi_c)*cos(theta_c);
+    unit_xp[1] = sin(phi_c)*cos(theta_c);
+    unit_xp[2] = -sin(theta_c);
+    unit_yp[0] = -sin(phi_c);
+    unit_yp[1] = cos(phi_c);
+    unit_yp[2] = 0;
+    unit_zp[0] = cos(phi_c)*sin(theta_c);
+    unit_zp[1] = sin(phi_c)*sin(theta_c);
+    unit_zp[2] = cos(theta_c);
+}
+
+// Turns a slice of psi_nlm at camera azimuth phi_c into the slice at
+// phi_c + delta_phi_c. The new plane is the old one rotated about the z
+// axis, which lowers the azimuth atan2(x, y) of every pixel by delta_phi_c,
+// so each value only picks up the phase e^(-i m delta_phi_c).
+void rotate_azimuth(complexd_t *psi, int size, int m, double delta_phi_c){
+    if (m == 0)
+        return;
+    complexd_t factor { std::polar(1.0, -m * delta_phi_c) };
+    int chunks { std::max(1, std::min(size / 4096, 4 * ThreadPool::global().size())) };
+    ThreadPool::global().parallel_for(chunks, [&](int c){
+        int first { (int)((long long)c * size / chunks) };
+        int last { (int)((long long)(c + 1) * size / chunks) };
+        // Written out, as in caxpy, to avoid the slow checked multiply
+        for (int i{first}; i < last; i++){
+            double re { psi[i].real() * factor.real() - psi[i].imag() * factor.imag() };
+            double im { psi[i].real() * factor.imag() + psi[i].imag() * factor.real() };
+            psi[i] = complexd_t(re, im);
+        }
+    });
 }
 
 // Adds v1 and v2 and puts result in v1
@@ -238,36 +471,58 @@ double *get_colors2_electric_boogaloo(int n, int l, int m, double phi_c, double
                       sin(phi_c)*sin(theta_c),
                       cos(theta_c)};
 
+    // The columns run along the camera axis, which lies in the mirror
+    // plane y_p = 0, so the mirror of symmetry.h still holds. The depth
+    // samples are not symmetric about the plane, so parity does not.
+    bool symmetric_y { symmetric_range(ymin, ymax) };
+    std::vector<complexd_t> average(n_x * n_y);
     double *colors { new double[size] };
-    double *itercol {colors};
-    double maximum_psi{0};
-    for (int i{0}; i < size/4; i++){
-        complexd_t cum_psi{0};
-        // Calculate x and y
-        double x_p = xmin + deltax * (int)(i / n_y);
-        double y_p = ymin + deltay * (i % n_y);
-        for (int j{0}; j < n_z; j++){
-            double z_p = - zmax + deltaz * j;
-            
-            // Calculate r, theta and phi
-            double p_coord[3] { x_p, y_p, z_p };
-            double car_coord[3];
-            convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
-            double sph_coord[3];
-            spherical_from_cart(car_coord, sph_coord);
-
-            cum_psi += psi_nlm(n, l, m, sph_coord[0], sph_coord[1], sph_coord[2]);
+    ThreadPool::global().parallel_for_tiles(n_x, n_y, cull_tile, cull_tile,
+            [&](int tx, int ex, int ty, int ey){
+        // The columns of the tile extend zmax to either side
+        RadialInterval interval { rect_radial_interval(
+                xmin + deltax * tx, xmin + deltax * (ex - 1),
+                ymin + deltay * ty, ymin + deltay * (ey - 1), zmax) };
+        bool skip { negligible(n, l, interval, 5e12) };
+
+        for (int ix{tx}; ix < ex; ix++){
+            for (int iy{ty}; iy < ey; iy++){
+                if (!fundamental(iy, n_y, symmetric_y))
+                    continue;
+                if (skip){
+                    average[ix * n_y + iy] = 0;
+                    continue;
+                }
+                complexd_t cum_psi{0};
+                // Calculate x and y
+                double x_p = xmin + deltax * ix;
+                double y_p = ymin + deltay * iy;
+                for (int j{0}; j < n_z; j++){
+                    double z_p = - zmax + deltaz * j;
+
+                    // Calculate r, theta and phi
+                    double p_coord[3] { x_p, y_p, z_p };
+                    double car_coord[3];
+                    convert_to_basis(p_coord, unit_xp, unit_yp, unit_zp, car_coord);
+                    double sph_coord[3];
+                    spherical_from_cart(car_coord, sph_coord);
+
+                    cum_psi += psi_nlm(n, l, m, sph_coord[0], sph_coord[1], sph_coord[2]);
+                }
+                average[ix * n_y + iy] = cum_psi / complex<double>(n_z, 0);
+            }
         }
-        complexd_t avg_psi {cum_psi / complex<double>(n_z, 0)};
+    });
+    fill_slice_symmetry(average.data(), l, m, phi_c, n_x, n_y, false, symmetric_y);
+
+    double maximum_psi{0};
+    double *itercol {colors};
+    for (const complexd_t &avg_psi : average){
         *(itercol++) = abs(real(avg_psi));
         *(itercol++) = 0.0;
         *(itercol++) = abs(imag(avg_psi));
         *(itercol++) = 1.0;
-
-        if (abs(real(avg_psi)) > maximum_psi)
-            maximum_psi = abs(real(avg_psi));
-        if (abs(imag(avg_psi)) > maximum_psi)
-            maximum_psi = abs(imag(avg_psi));
+        maximum_psi = std::max({maximum_psi, abs(real(avg_psi)), abs(imag(avg_psi))});
     }
     if (maximum_psi == 0)
         return colors;
@@ -0,0 +1,7 @@
+#pragma once
+
+// Debug counter of heap allocations. Building with -DCOUNT_ALLOCATIONS
+// (make allocations) replaces the global operator new so that every
+// allocation is counted; otherwise the count is always 0.
+unsigned long allocation_count();
+bool counting_allocations();
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <numeric>
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./threadpool.h"
+#include "./radial.h"
+
+// Spreads the evaluation of a slice over several frames. Every frame a
+// slice of a fixed interleaved pixel order (8x8 Bayer ranks, so each
+// update is spread evenly over the image) is recomputed at the current
+// camera angles, and all other pixels keep their value from earlier
+// frames. How many pixels fit is decided from the measured cost per
+// pixel and a budget in microseconds. Changing n, l, m, the zoom or the
+// resolution invalidates the history; moving the camera does not, and
+// turning it about the z axis alone keeps every pixel exact.
+class AmortisedRenderer {
+public:
+    AmortisedRenderer();
+
+    void setState(int n, int l, int m, double xmin, double xmax,
+                  double ymin, double ymax, int n_x, int n_y);
+    void setView(double phi_c, double theta_c);
+
+    bool update(double budget_us);
+    bool converged();
+    const complexd_t *image();
+
+private:
+    int n;
+    int l;
+    int m;
+    double xmin;
+    double xmax;
+    double ymin;
+    double ymax;
+    int n_x;
+    int n_y;
+    double phi_c;
+    double theta_c;
+    bool valid;
+
+    std::vector<int> order;
+    size_t cursor;
+    // Pixels computed since the camera last moved
+    size_t fresh;
+    // Pixels computed at least once since the history was invalidated
+    size_t seen;
+    std::vector<char> computed;
+    RadialCache radial;
+    std::vector<complexd_t> history;
+    // Exponential moving average of the cost of one pixel in microseconds
+    double pixel_us;
+
+    void buildOrder();
+};
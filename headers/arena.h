@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "./threadpool.h"
+
+// Scratch memory for the buffers of one frame. take() hands out pieces of
+// a single block and reset() gives all of them back at once. A frame that
+// needs more than the block spills into extra blocks; the next reset
+// replaces them by one block that holds everything, so once the frames
+// have reached their working size the arena no longer touches the heap.
+class Arena {
+public:
+    Arena();
+
+    // Uninitialised room for count objects of type T, valid until reset()
+    template <typename T>
+    T *take(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+        return static_cast<T *>(raw(count * sizeof(T), alignof(T)));
+    }
+
+    void reset();
+    size_t capacity();
+
+    // Gives back what was taken during its lifetime, so that the
+    // iterations of a loop reuse the same memory
+    class Scope {
+    public:
+        explicit Scope(Arena &arena) : arena(arena), mark(arena.used) {}
+        ~Scope() { arena.used = mark; }
+    private:
+        Arena &arena;
+        size_t mark;
+    };
+
+private:
+    std::unique_ptr<unsigned char[]> block;
+    size_t size;
+    size_t used;
+    std::vector<std::unique_ptr<unsigned char[]>> spill;
+    size_t spilled;
+
+    void *raw(size_t bytes, size_t align);
+};
+
+// One arena per thread of the global pool, for scratch that is taken
+// inside parallel loops. Every owner (a Plane, say) has its own set and
+// resets it at the start of each of its frames.
+class ScratchArenas {
+public:
+    ScratchArenas();
+
+    // Arena of the calling thread
+    Arena &local();
+    void reset();
+
+private:
+    std::vector<Arena> arenas;
+};
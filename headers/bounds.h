@@ -0,0 +1,24 @@
+#pragma once
+
+#include <algorithm>
+
+#include "./wavefunction.h"
+
+// A colour channel below half of one 8-bit step is displayed as black
+inline const double display_threshold = 1.0 / 512;
+// |psi| shown at full brightness at the highest sensitivity. Images that
+// the shader normalises are culled against it, so that no sensitivity
+// change can bring back a region that was left black.
+inline const double min_normalization = 1e12;
+
+// Range of distances from the origin covered by some region of space
+struct RadialInterval
+{
+    double r_min;
+    double r_max;
+};
+
+RadialInterval rect_radial_interval(double x0, double x1, double y0, double y1, double zmax=0);
+RadialInterval sphere_radial_interval(const double centre[3], double radius);
+double psi_bound(int n, int l, RadialInterval interval);
+bool negligible(int n, int l, RadialInterval interval, double normalization_const);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./superposition.h"
+#include "./threadpool.h"
+#include "./arena.h"
+
+complexd_t grad_psi_nlm(int n, int l, int m, const double pos[3], complexd_t grad[3]);
+void probability_current(const std::vector<State> &states, const double pos[3], double j[3]);
+
+// Traces streamlines of the probability current j ~ Im(psi* grad psi),
+// projected onto the plane of the slice. Lines are advanced together with
+// an adaptive Bogacki-Shampine 3(2) integrator so that every stage is one
+// batched field query over all active lines; seeds are split across the pool.
+class StreamlineTracer {
+public:
+    StreamlineTracer();
+
+    void setStates(const std::vector<State> &states);
+    void setView(double phi_c, double theta_c, double xmin, double xmax,
+                 double ymin, double ymax);
+    void setSeeds(int seeds_x, int seeds_y);
+
+    bool trace(ScratchArenas &scratch);
+    // Polylines in plane coordinates (x_p, y_p pairs)
+    const std::vector<std::vector<double>> &getLines();
+
+private:
+    std::vector<State> states;
+    double unit_xp[3];
+    double unit_yp[3];
+    double unit_zp[3];
+    double phi_c;
+    double theta_c;
+    double xmin;
+    double xmax;
+    double ymin;
+    double ymax;
+    int seeds_x;
+    int seeds_y;
+    bool valid;
+
+    std::vector<std::vector<double>> lines;
+
+    void fieldBatch(const double *xs, const double *ys, int count, double *vx, double *vy);
+    void traceRange(int first, int last, Arena &scratch);
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./superposition.h"
+#include "./quadrature.h"
+#include "./threadpool.h"
+
+// Complex field sampled on a cubic Cartesian grid centred at the origin,
+// point (i, j, k) at -half_width + 2 half_width (i, j, k) / (size - 1)
+class CartesianGrid {
+public:
+    CartesianGrid(int size, double half_width);
+
+    complexd_t &at(int i, int j, int k);
+    complexd_t sample(const double pos[3]);
+    int getSize();
+    double getHalfWidth();
+
+private:
+    int size;
+    double half_width;
+    std::vector<complexd_t> data;
+};
+
+std::vector<State> decompose(const std::function<complexd_t(const double pos[3])> &field,
+                             int n_max, double r_max, int n_r = 128, double rel_cutoff = 1e-6);
+std::vector<State> decompose(CartesianGrid &grid, int n_max, int n_r = 128, double rel_cutoff = 1e-6);
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Everything a cached result depends on, as raw bytes. The file name is
+// a hash of them, and the bytes themselves are stored in the file and
+// compared on load, so that a hash collision can only cost a miss. Keys
+// live on the stack, so that looking one up does not allocate.
+class CacheKey {
+public:
+    static const size_t capacity = 256;
+
+    explicit CacheKey(const char *kind);
+
+    CacheKey &add(int value);
+    CacheKey &add(double value);
+    CacheKey &add(const char *value);
+
+    const char *bytes() const;
+    size_t size() const;
+    uint64_t hash() const;
+
+private:
+    char data[capacity];
+    size_t used;
+
+    void append(const void *value, size_t bytes);
+};
+
+// Content addressed cache of computed arrays on disk, under
+// $HYDROGEN_CACHE_DIR, or else $XDG_CACHE_HOME/hydrogen or
+// ~/.cache/hydrogen. An empty HYDROGEN_CACHE_DIR turns it off.
+// Files are written to a temporary name and renamed into place, and are
+// memory mapped and checksummed on load; a file that fails the check is
+// deleted. Every failure is a miss, never an error.
+// The directory is kept under capacity_bytes ($HYDROGEN_CACHE_MB) by
+// deleting the least recently used files, a hit counting as a use, and
+// temporary files left behind by a crashed writer are deleted with them.
+// store() writes on the calling thread; storeLater() copies the data and
+// leaves the write to a background thread, for callers that draw frames.
+class DiskCache {
+public:
+    explicit DiskCache(const std::string &dir, size_t capacity_bytes = default_capacity);
+    ~DiskCache();
+
+    static constexpr size_t default_capacity = (size_t)256 << 20;
+
+    static DiskCache &global();
+
+    bool enabled();
+    bool load(const CacheKey &key, void *data, size_t bytes);
+    bool store(const CacheKey &key, const void *data, size_t bytes);
+    void storeLater(const CacheKey &key, const void *data, size_t bytes);
+    // Waits until every storeLater() so far is on disk
+    void flush();
+    void trim();
+
+private:
+    struct Pending
+    {
+        CacheKey key;
+        std::vector<char> data;
+    };
+
+    std::string dir;
+    bool ready;
+    size_t capacity;
+    // Bytes stored since the directory was last trimmed, which it is at
+    // the first store
+    size_t unchecked;
+    bool trimmed;
+    std::mutex trimming;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable written;
+    std::vector<Pending> pending;
+    // Buffers of finished writes, so that storing again does not allocate
+    std::vector<std::vector<char>> spare;
+    size_t pending_bytes;
+    bool writing;
+    bool stop;
+
+    void path(const CacheKey &key, char *out, size_t size);
+    void write();
+};
+
+uint64_t fnv1a(const void *data, size_t bytes, uint64_t hash = 14695981039346656037ull);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./threadpool.h"
+#include "./symmetry.h"
+#include "./diskcache.h"
+
+// Mixed radix 2/3/5 Stockham FFT of one length. The plan holds the
+// factorisation and per-stage twiddles and may be shared between threads.
+class FFTPlan {
+public:
+    FFTPlan(int n, int sign);
+
+    static bool supported(int n);
+    int size();
+    void execute(complexd_t *data, complexd_t *scratch) const;
+
+private:
+    int n;
+    int sign;
+    std::vector<int> radices;
+    std::vector<complexd_t> twiddles;
+    std::vector<complexd_t> roots3;
+    std::vector<complexd_t> roots5;
+};
+
+void fft3d(complexd_t *data, int nx, int ny, int nz, int sign);
+void rfft3d(const double *in, complexd_t *out, int nx, int ny, int nz);
+complexd_t *get_volume(int n, int l, int m, double half_width, int size);
+double *momentum_density(int n, int l, int m, double half_width, int size);
+double fft_benchmark(int size, int repeats);
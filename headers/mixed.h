@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./threadpool.h"
+
+// Incoherent mixture sum_k w_k |psi_k|^2 of hydrogen eigenstates.
+// Whatever weight a level (n, l) carries equally in all of its 2l+1
+// substates is, by Unsold's theorem, the purely radial density
+// w (2l+1)/4pi Rnl^2. Those parts are summed into one radial table so
+// that full shells and thermal mixtures cost one lookup per pixel.
+class MixedState {
+public:
+    MixedState();
+
+    void clear();
+    void add(int n, int l, int m, double w);
+    void addShell(int n, double w);
+    static MixedState thermal(int n_max, double kT);
+
+    double density(double r, double theta, double phi);
+    complexd_t *get_psi(double phi_c, double theta_c, double xmin, double xmax,
+                        double ymin, double ymax, int n_x, int n_y);
+    void get_psi(double phi_c, double theta_c, double xmin, double xmax,
+                 double ymin, double ymax, int n_x, int n_y, complexd_t *psi);
+
+private:
+    struct Term
+    {
+        int n;
+        int l;
+        int m;
+        double w;
+    };
+
+    // Weight of each m = -l..l of every level (n, l) that has been added
+    std::map<std::pair<int, int>, std::vector<double>> levels;
+
+    std::vector<Term> residual;
+    std::vector<double> table;
+    double table_rmax;
+    bool valid;
+
+    void reduce();
+    double radial(double r);
+};
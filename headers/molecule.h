@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./threadpool.h"
+#include "./arena.h"
+
+// A hydrogenic orbital c * psi_nlm centred on a nucleus at pos
+struct Centre
+{
+    double pos[3];
+    int n;
+    int l;
+    int m;
+    complexd_t c;
+    double cutoff;
+};
+
+// Linear combination of atomic orbitals on several nuclei.
+// Centres are binned in a uniform grid with cells as wide as the largest
+// cutoff radius, so each tile of the slice only visits the centres whose
+// cutoff sphere reaches it.
+class Molecule {
+public:
+    Molecule();
+
+    void setCentres(const std::vector<Centre> &centres);
+    void setTolerance(double rel_tol);
+    size_t centreCount();
+
+    complexd_t psi(const double pos[3]);
+    complexd_t *get_psi(double phi_c, double theta_c, double xmin, double xmax,
+                        double ymin, double ymax, int n_x, int n_y);
+    void get_psi(double phi_c, double theta_c, double xmin, double xmax,
+                 double ymin, double ymax, int n_x, int n_y,
+                 complexd_t *psi, ScratchArenas &scratch);
+
+    static std::vector<Centre> h2plus(bool bonding);
+    static std::vector<Centre> chain(int count, double spacing, int n, int l, int m);
+    static std::vector<Centre> lattice(int count_x, int count_y, double spacing, int n, int l, int m);
+    static std::vector<Centre> overlapping_lattice(int n, int l, int m);
+
+private:
+    std::vector<Centre> centres;
+    double rel_tol;
+
+    double cell;
+    double origin[3];
+    int dims[3];
+    std::vector<int> cell_start;
+    std::vector<int> cell_items;
+
+    void buildGrid();
+    int query(const double pos[3], double radius, int *out);
+    complexd_t evaluate(const Centre &centre, const double pos[3]);
+};
@@ -1,13 +1,28 @@
 #pragma once
 
+#include <chrono>
 #include <vector>
 #include <iostream>
+#include <string>
 
 #include "./glm/glm.hpp"
 #include "./wavefunction.h"
+#include "./superposition.h"
+#include "./molecule.h"
+#include "./mixed.h"
+#include "./current.h"
+#include "./progressive.h"
+#include "./amortised.h"
+#include "./rotation.h"
+#include "./arena.h"
+#include "./slicecache.h"
+#include "./prefetch.h"
+#include "./tiles.h"
 
 class Plane {
 public:
+    using Mode = SliceMode;
+
     Plane(float width, float height, int tileW, int tileH);
     ~Plane();
 
@@ -20,6 +35,9 @@ public:
     int getn();
     int getl();
     int getm();
+    int getTileW();
+    int getTileH();
+    bool setResolution(int tileW, int tileH);
 
     void increment_n();
     void increment_l();
@@ -33,8 +51,34 @@ public:
 
     void incSensitivity();
     void decSensitivity();
+    double getNormalization();
+    void toggleLogScale();
+    bool logScale();
+
+    void setSuperposition(const std::vector<State> &states);
+
+    void toggleAmortised();
+    bool isAmortised();
+
+    void toggleTiled();
+    bool isTiled();
+
+    void cycleMode();
+    Mode getMode();
+    std::string modeName();
 
-    void updateColors(double phi, double theta);
+    void setInteracting(bool active);
+    bool showsPreview();
+    bool rendered();
+    bool updateColors(double phi, double theta, double t = 0);
+    SliceCache::Stats cacheStats();
+    void setCacheCapacity(size_t bytes);
+
+    void toggleCurrent();
+    bool showsCurrent();
+    bool updateStreamlines(double phi, double theta, double t = 0);
+    float* getStreamlines();
+    size_t streamlinesSize();
 
 private:
     float width;
@@ -47,10 +91,85 @@ private:
     float awidth;
     float aheight;
     double norm_const;
+    Mode mode;
+
+    bool log_scale;
+
+    // Bumped by everything that changes the wavefunction image
+    unsigned long version;
+    // What the vertex colours currently show. complete is false while a
+    // renderer is still refining, so that it keeps getting called.
+    struct Drawn {
+        unsigned long version;
+        double phi;
+        double theta;
+        double t;
+        bool complete;
+    } drawn;
+    std::vector<complexd_t> image;
+    // Finished images of recently shown states, and what is on screen now:
+    // shown_image is the renderer's buffer, or null if it is not cacheable
+    SliceCache cache;
+    SliceKey shown_key;
+    const complexd_t *shown_image;
+    // Renders the neighbouring states into the cache while the view is idle
+    Prefetcher prefetcher;
+    std::vector<SliceKey> neighbours;
+    bool prefetched;
+    // Per-thread scratch of the current frame
+    ScratchArenas scratch;
+    // While the view is moved by input, frames show a preview with a
+    // quarter of the samples, and the lattice with a looser cutoff. Once
+    // input has been idle for settle_ms, the prefetcher renders the full
+    // image and it replaces the preview when it is ready.
+    static constexpr double settle_ms = 150;
+    std::chrono::steady_clock::time_point last_input;
+    bool preview_shown;
+    bool full_requested;
+    // Whether the last updateColors computed the full image, rather than
+    // copying one from a cache or showing a preview
+    bool full_rendered;
+    std::vector<complexd_t> preview;
+    TimeEvolution preview_evolution;
+    Molecule preview_molecule;
+
+    std::vector<State> superposition;
+    std::vector<State> default_states;
+    std::vector<State> traced_states;
+    TimeEvolution evolution;
+    Molecule molecule;
+    MixedState shell;
+    int shell_n;
+    int lattice_n;
+    int lattice_l;
+    int lattice_m;
+    bool show_current;
+    // Time per frame that the slice may spend refining its image
+    double frame_budget_us;
+    ProgressiveRenderer progressive;
+    RotatedSlice rotated;
+    bool amortised;
+    AmortisedRenderer amortiser;
+    bool tiled;
+    TilePyramid pyramid;
+    StreamlineTracer tracer;
 
     std::vector<float> vertices;
     std::vector<unsigned int> indices;
+    std::vector<float> streamlines;
+    // The streamline vertices were laid out for another resolution
+    bool streamlines_stale;
 
     void generateVertices();
     void generateIndices();
+    void setColors(const complexd_t *psi);
+    OutputSpan<float> colorSpan();
+    void invalidate();
+    void prefetchNeighbours();
+    bool previewing();
+    bool renderPreview(double phi, double theta, double t, bool turning);
+    bool showFull();
+    void updateLattice();
+    void updateShell();
+    const std::vector<State> &evolutionStates();
 };
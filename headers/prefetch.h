@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./symmetry.h"
+#include "./threadpool.h"
+#include "./slicecache.h"
+#include "./molecule.h"
+#include "./mixed.h"
+#include "./arena.h"
+
+// Renders slices that are likely to be asked for next, or that are shown
+// as a preview for now, on a background thread, so that they are in the
+// slice cache by the time they are. Orbitals, lattices and shells can be
+// rendered; the evolution depends on time and is not. The thread first
+// looks in the disk cache and stores what it renders there.
+// It runs at the lowest priority, keeps its loops off the pool and
+// checks between rows whether it has been cancelled, so it never holds up
+// a frame. Finished images are handed over by collect(), on the thread
+// that owns the cache.
+class Prefetcher {
+public:
+    Prefetcher();
+    ~Prefetcher();
+
+    void request(const std::vector<SliceKey> &keys);
+    void cancel();
+    void collect(SliceCache &cache);
+
+private:
+    struct Result
+    {
+        SliceKey key;
+        std::vector<complexd_t> image;
+    };
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    // Pending keys, the last one first
+    std::vector<SliceKey> jobs;
+    std::vector<Result> results;
+    // Bumped by every request and cancel; a job of an older generation stops
+    std::atomic<unsigned long> generation;
+    bool busy;
+    bool stop;
+
+    // Only used by the thread
+    Molecule molecule;
+    MixedState shell;
+    int shell_n;
+    ScratchArenas scratch;
+
+    void work();
+    bool render(const SliceKey &key, unsigned long started, std::vector<complexd_t> &psi);
+    bool renderOrbital(const SliceKey &key, unsigned long started, std::vector<complexd_t> &psi);
+    bool renderStrips(const SliceKey &key, unsigned long started, std::vector<complexd_t> &psi);
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./bounds.h"
+#include "./threadpool.h"
+#include "./radial.h"
+
+// Renders a slice coarse to fine across frames. The first call after a
+// change samples every 8th pixel and fills 8x8 blocks, which takes a
+// fraction of a frame. Each block is then a quadtree node that samples
+// the three missing corners of its quadrants and only subdivides further
+// where those samples differ by more than the tolerance, so smooth
+// regions stop early while nodal lines are refined down to single pixels.
+// Nodes run on the work-stealing pool until the frame budget is used up.
+// Once every node has run, the blocks that still hold interpolated pixels
+// are computed pixel by pixel, and only then is the image done().
+//
+// When only the zoom or the view angles change, the previous image is
+// reprojected instead of thrown away: every new pixel is mapped into the
+// old plane and interpolated from it. Blocks that fall outside the old
+// image, have drifted so far off the plane they were computed on that the
+// estimated error exceeds the tolerance, are magnified too much or have
+// been interpolated too many frames in a row are recomputed first. The
+// remaining blocks are recomputed pixel by pixel afterwards, so that
+// continuous zooming and rotating only pays for the parts of the image
+// that really changed.
+class ProgressiveRenderer {
+public:
+    ProgressiveRenderer();
+
+    void setState(int n, int l, int m, double phi_c, double theta_c,
+                  double xmin, double xmax, double ymin, double ymax, int n_x, int n_y);
+    void setTolerance(double tol);
+
+    bool refine(double budget_us);
+    bool done();
+    const complexd_t *image();
+
+private:
+    struct View {
+        double xmin;
+        double ymin;
+        double deltax;
+        double deltay;
+        double unit_xp[3];
+        double unit_yp[3];
+        double unit_zp[3];
+    };
+
+    int n;
+    int l;
+    int m;
+    double phi_c;
+    double theta_c;
+    double xmin;
+    double xmax;
+    double ymin;
+    double ymax;
+    int n_x;
+    int n_y;
+    double tol;
+
+    double deltax;
+    double deltay;
+    double unit_xp[3];
+    double unit_yp[3];
+    double unit_zp[3];
+    // Largest |psi| seen in the coarse pass, the scale for the error estimate
+    double scale;
+    bool started;
+    // Whether the blocks that the nodes left interpolated have been queued
+    bool finishing;
+
+    RadialCache radial;
+    std::vector<complexd_t> psi;
+    // Frames since each pixel was last computed rather than interpolated,
+    // and an estimate of the error it has picked up since, which is
+    // infinite at the corner of a node that stopped refining
+    std::vector<unsigned char> age;
+    std::vector<float> error;
+    std::vector<complexd_t> previous;
+    std::vector<unsigned char> previous_age;
+    std::vector<float> previous_error;
+    // What each block needs after a reprojection: nothing until the
+    // refresh, an exact pass because its preview is too old or too far
+    // off, or a restart because it has none
+    enum Need : char { Keep, Exact, Restart };
+    std::vector<Need> need;
+    // Blocks that have no usable preview run before blocks that do
+    std::vector<ThreadPool::Task> urgent;
+    std::vector<ThreadPool::Task> refresh;
+
+    complexd_t sample(int ix, int iy);
+    void fill(int ix, int iy, int size, complexd_t value);
+    void node(int ix, int iy, int size);
+    void coarsePass();
+    View view();
+    void reproject(const View &from);
+    void restart(int ix, int iy);
+    void exact(int ix, int iy);
+    void queueInterpolated();
+};
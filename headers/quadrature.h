@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+void gauss_legendre(int n, double a, double b, std::vector<double> &nodes, std::vector<double> &weights);
+void gauss_legendre(int n, double a, double b, double *nodes, double *weights);
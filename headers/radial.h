@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+
+#include "./wavefunction.h"
+#include "./symmetry.h"
+
+// Rnl(r) of every pixel of a slice through the origin. The radius of a
+// pixel is sqrt(x_p^2 + y_p^2) whatever the camera angles are, so the
+// radial factor only has to be evaluated again when n, l, the zoom or the
+// resolution change, and turning the camera only costs the angular part.
+// Entries are evaluated on first use, so renderers that skip pixels do
+// not pay for them, and may be read from several threads at once.
+class RadialCache {
+public:
+    RadialCache();
+
+    void setState(int n, int l, double xmin, double xmax, double ymin, double ymax,
+                  int n_x, int n_y);
+    double at(int ix, int iy);
+
+private:
+    int n;
+    int l;
+    double xmin;
+    double xmax;
+    double ymin;
+    double ymax;
+    int n_x;
+    int n_y;
+    double deltax;
+    double deltay;
+    bool symmetric_x;
+    bool symmetric_y;
+    bool valid;
+
+    // NaN until evaluated. Atomic so that two threads evaluating the same
+    // pixel do not race; both store the same value.
+    std::unique_ptr<std::atomic<double>[]> values;
+    int capacity;
+};
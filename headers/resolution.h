@@ -0,0 +1,33 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// Picks the number of samples per side of the plane from the measured
+// time of the frames that computed and uploaded an image, so that they
+// take about target_ms. The cost of a frame goes with the square of the
+// samples per side. It only shrinks once the average is well above the
+// target and only grows once it is well below, and waits a few frames
+// after every change, so that it settles instead of oscillating. Sizes
+// are multiples of step, so that the slice cache sees few distinct ones.
+class ResolutionController {
+public:
+    ResolutionController(int samples, int floor, int ceiling, double target_ms);
+
+    // Time of one frame that did work. Returns whether size() changed.
+    bool record(double ms);
+    int size();
+    double average();
+
+private:
+    int samples;
+    int floor;
+    int ceiling;
+    double target_ms;
+    // Exponential moving average of the frames since the last change
+    double average_ms;
+    int measured;
+
+    static const int step = 10;
+    static const int settle_frames = 8;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./superposition.h"
+#include "./quadrature.h"
+#include "./threadpool.h"
+#include "./radial.h"
+#include "./symmetry.h"
+#include "./arena.h"
+#include "./diskcache.h"
+
+void rotation_coefficients(int l, int m, const double unit_xp[3], const double unit_yp[3],
+                           const double unit_zp[3], std::vector<complexd_t> &coeffs,
+                           Arena &scratch);
+
+// Slices of a fixed (n, l) at any camera angle from a few cached images.
+// The slice seen by the camera is the z = 0 slice of the state rotated by
+// the camera, and a rotated Ylm is a Wigner-D weighted sum of the Ylm' of
+// the same l, so every view is a complex sum of the z = 0 slices of the
+// psi_nlm'. Only m' with l + m' even are needed, the others vanish on the
+// z = 0 plane. The cache depends on n, l, the zoom and the resolution,
+// but not on m or the camera angles.
+class RotatedSlice {
+public:
+    RotatedSlice();
+
+    void setState(int n, int l, int m, double xmin, double xmax,
+                  double ymin, double ymax, int n_x, int n_y);
+
+    bool ready();
+    void build(double budget_us);
+    const complexd_t *render(double phi_c, double theta_c, Arena &scratch);
+
+private:
+    int n;
+    int l;
+    int m;
+    double xmin;
+    double xmax;
+    double ymin;
+    double ymax;
+    int n_x;
+    int n_y;
+    bool valid;
+
+    CacheKey diskKey();
+
+    // z = 0 slices for m' = -l, -l + 2, ..., l, one after the other
+    std::vector<complexd_t> basis;
+    RadialCache radial;
+    int built;
+    std::vector<complexd_t> coeffs;
+    std::vector<complexd_t> psi;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./diskcache.h"
+
+// What the plane shows: one orbital, the time evolution of a
+// superposition, a lattice of orbitals or the density of a whole shell
+enum class SliceMode { Slice, Evolution, Molecule, Shell };
+
+// Everything a finished slice image depends on. mode is a SliceMode,
+// angles and extents are those of the view.
+struct SliceKey
+{
+    int n;
+    int l;
+    int m;
+    int mode;
+    double phi_c;
+    double theta_c;
+    double width;
+    double height;
+    int n_x;
+    int n_y;
+
+    bool operator==(const SliceKey &other) const;
+};
+
+struct SliceKeyHash
+{
+    size_t operator()(const SliceKey &key) const;
+};
+
+CacheKey slice_disk_key(const SliceKey &key);
+
+// Completed slice images, least recently used first to go once they take
+// up more than the memory cap. Going back to a state that was on screen a
+// moment ago is then a copy instead of a new render.
+class SliceCache {
+public:
+    struct Stats
+    {
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long evictions;
+        size_t entries;
+        size_t bytes;
+    };
+
+    explicit SliceCache(size_t capacity_bytes = 64 << 20);
+
+    void setCapacity(size_t capacity_bytes);
+    size_t getCapacity();
+
+    const complexd_t *find(const SliceKey &key);
+    bool contains(const SliceKey &key);
+    void insert(const SliceKey &key, const complexd_t *psi);
+    void clear();
+    Stats stats();
+
+private:
+    struct Entry
+    {
+        SliceKey key;
+        std::vector<complexd_t> image;
+    };
+
+    // Most recently used at the front
+    std::list<Entry> entries;
+    std::unordered_map<SliceKey, std::list<Entry>::iterator, SliceKeyHash> index;
+    size_t capacity;
+    size_t bytes;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+
+    void evict();
+};
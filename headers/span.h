@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+// Caller-owned output with a fixed distance between consecutive pixels, so
+// that kernels can write straight into interleaved buffers such as the
+// vertex array. Pixel i starts at data + i * stride, in elements of T.
+template <typename T>
+struct OutputSpan
+{
+    T *data;
+    int stride;
+
+    T *pixel(int i) const { return data + (size_t)i * stride; }
+};
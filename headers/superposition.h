@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "./wavefunction.h"
+
+// One term c * psi_nlm of a superposition
+struct State
+{
+    int n;
+    int l;
+    int m;
+    complexd_t c;
+};
+
+void caxpy(complexd_t a, const complexd_t *x, complexd_t *y, int size);
+
+class TimeEvolution {
+public:
+    TimeEvolution();
+    ~TimeEvolution();
+
+    void setStates(const std::vector<State> &states);
+    void setView(double phi_c, double theta_c, double xmin, double xmax,
+                 double ymin, double ymax, int n_x, int n_y);
+
+    complexd_t *evolve(double t);
+
+private:
+    // All terms sharing a principal quantum number share an energy, so they
+    // are summed into a single image that only picks up a common phase
+    struct Component
+    {
+        int n;
+        complexd_t *image;
+    };
+
+    std::vector<State> states;
+    std::vector<Component> components;
+    int image_size;
+    // One term at a time, before it is added to its component
+    std::vector<complexd_t> term;
+    complexd_t *psi;
+
+    double phi_c;
+    double theta_c;
+    double xmin;
+    double xmax;
+    double ymin;
+    double ymax;
+    int n_x;
+    int n_y;
+    bool valid;
+
+    void clearComponents();
+    void buildComponents();
+};
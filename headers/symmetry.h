@@ -0,0 +1,25 @@
+#pragma once
+
+#include "./wavefunction.h"
+#include "./threadpool.h"
+
+// Symmetries of psi_nlm that let the grids be evaluated on part of their
+// points only, with the rest filled in by signed or conjugated copies.
+//
+// Parity: psi(-r) = (-1)^l psi(r).
+// Every slice through the origin is mirrored in the vertical plane that
+// contains the camera axis, y_p -> -y_p. That takes the azimuth
+// atan2(x, y) to pi - 2 phi_c - phi, so psi -> e^(i m (pi - 2 phi_c)) conj(psi).
+// Axis aligned grids are mirrored in each coordinate plane:
+//     x -> -x: conj(psi)
+//     y -> -y: (-1)^m conj(psi)
+//     z -> -z: (-1)^(l+m) psi
+//
+// All grids here are endpoint exclusive, so on an axis of n points from -w
+// to w point i mirrors to n - i and point 0 has no partner. The points
+// that have to be evaluated are 0 and those from the centre onwards.
+bool symmetric_range(double min, double max);
+bool fundamental(int i, int n, bool symmetric = true);
+void fill_slice_symmetry(complexd_t *psi, int l, int m, double phi_c, int n_x, int n_y,
+                         bool symmetric_x, bool symmetric_y);
+void fill_volume_symmetry(complexd_t *vol, int l, int m, int size);
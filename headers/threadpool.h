@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Persistent worker threads that run parallel loops. The calling thread
+// takes part in every loop, so a pool of size 1 has no workers at all.
+// Iterations are handed out dynamically, but as long as each iteration
+// writes only its own outputs the result is bitwise identical for any
+// number of threads.
+//
+// run_tasks executes a set of tasks that may spawn further tasks. Every
+// thread keeps its own deque, works on its newest task and steals the
+// oldest task of another thread when it runs dry.
+//
+// Neither kind of work touches the heap once the queues have grown to
+// their working size: loop bodies are passed on by reference and tasks
+// keep their captures inline.
+class ThreadPool {
+public:
+    // A callable whose captures are stored in the task itself. They have
+    // to be trivially copyable (pointers, indices, references) and fit in
+    // capture_size bytes, which is checked at compile time.
+    class Task {
+    public:
+        static const size_t capture_size = 4 * sizeof(void *);
+
+        Task() : call(nullptr) {}
+        Task(std::nullptr_t) : call(nullptr) {}
+        template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, Task>::value>>
+        Task(F f) {
+            static_assert(sizeof(F) <= capture_size, "task captures too large");
+            static_assert(alignof(F) <= alignof(void *), "task captures overaligned");
+            static_assert(std::is_trivially_copyable<F>::value, "task captures must be trivially copyable");
+            new (storage) F(f);
+            call = [](void *captures){ (*static_cast<F *>(captures))(); };
+        }
+
+        void operator()() { call(storage); }
+        explicit operator bool() const { return call != nullptr; }
+
+    private:
+        void *storage[4];
+        void (*call)(void *);
+    };
+    using Clock = std::chrono::steady_clock;
+
+    explicit ThreadPool(int threads = 0, bool pin = false);
+    ~ThreadPool();
+
+    static ThreadPool &global();
+    static int thread_index();
+    static void run_loops_inline();
+    static void lower_priority();
+
+    int size();
+    void resize(int threads, bool pin = false);
+
+    // Calls body(i) for every i in [0, count) and returns when all are done
+    template <typename Body>
+    void parallel_for(int count, const Body &body) {
+        // A reference_wrapper fits into std::function without an allocation
+        loop(count, std::cref(body));
+    }
+
+    // Splits an n_x by n_y image into tiles and calls body(x0, x1, y0, y1) on
+    // each, with [x0, x1) x [y0, y1) the pixel ranges of the tile
+    template <typename Body>
+    void parallel_for_tiles(int n_x, int n_y, int tile_x, int tile_y, const Body &body) {
+        int tiles_x { (n_x + tile_x - 1) / tile_x };
+        int tiles_y { (n_y + tile_y - 1) / tile_y };
+        parallel_for(tiles_x * tiles_y, [&](int t){
+            int x0 { (t / tiles_y) * tile_x };
+            int y0 { (t % tiles_y) * tile_y };
+            body(x0, std::min(x0 + tile_x, n_x), y0, std::min(y0 + tile_y, n_y));
+        });
+    }
+
+    void run_tasks(std::vector<Task> &tasks, Clock::time_point deadline = Clock::time_point::max());
+    static void spawn(Task task);
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    // Held for the whole of a loop so that loops from different threads queue up
+    std::mutex submit;
+
+    const std::function<void(int)> *body;
+    int count;
+    std::atomic<int> next;
+    int busy;
+    unsigned long generation;
+    bool stop;
+
+    // The owner pushes and pops at the back, thieves take from head. The
+    // vector is only cleared once it has been emptied, so it keeps its capacity.
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::vector<Task> tasks;
+        size_t head = 0;
+    };
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::atomic<int> pending;
+    Clock::time_point deadline;
+
+    void loop(int count, const std::function<void(int)> &body);
+    void start(int threads, bool pin);
+    void stealLoop(int slot);
+    bool popTask(int slot, Task &task);
+    void shutdown();
+    void work(int index, bool pin);
+    void runItems();
+};
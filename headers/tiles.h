@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "./wavefunction.h"
+#include "./diskcache.h"
+
+// Tile (tx, ty) of the given level of the slice of psi_nlm seen from
+// (phi_c, theta_c)
+struct TileKey
+{
+    int n;
+    int l;
+    int m;
+    double phi_c;
+    double theta_c;
+    int level;
+    int tx;
+    int ty;
+
+    bool operator==(const TileKey &other) const;
+};
+
+struct TileKeyHash
+{
+    size_t operator()(const TileKey &key) const;
+};
+
+// Quadtree of square tiles of the slice plane, like map tiles. Tiles of
+// level z are base_size / 2^z wide, with tile_samples^2 samples at the
+// centres of their cells, so every level has twice the resolution of the
+// one before. A view is drawn by nearest sample from the level whose
+// samples are just finer than its pixels. Zooming therefore only renders
+// tiles when it crosses into the next level, and those are rendered ahead
+// with whatever is left of the frame budget. Tiles are kept, least
+// recently used first to go, so zooming back and forth renders nothing.
+class TilePyramid {
+public:
+    static const int tile_samples = 32;
+    static constexpr double base_size = 1e-8;
+
+    // The cap has to hold the tiles of a few views
+    explicit TilePyramid(size_t capacity_bytes = 32 << 20);
+
+    void setState(int n, int l, int m, double phi_c, double theta_c);
+    bool render(double xmin, double xmax, double ymin, double ymax, int n_x, int n_y,
+                complexd_t *psi, double budget_us);
+    bool complete();
+    size_t tileCount();
+
+private:
+    struct Tile
+    {
+        TileKey key;
+        std::vector<complexd_t> samples;
+    };
+
+    int n;
+    int l;
+    int m;
+    double phi_c;
+    double theta_c;
+    // Whether every visible tile and every tile of the next level in is there
+    bool done;
+
+    // Most recently used at the front
+    std::list<Tile> tiles;
+    std::unordered_map<TileKey, std::list<Tile>::iterator, TileKeyHash> index;
+    size_t capacity;
+    // Tiles of the drawn level over the visible range, null where missing
+    std::vector<const complexd_t *> visible;
+
+    static int levelFor(double spacing);
+    TileKey key(int level, int tx, int ty);
+    const complexd_t *find(int level, int tx, int ty);
+    bool build(int level, int tx, int ty);
+    const complexd_t *coarser(int level, double x, double y);
+};
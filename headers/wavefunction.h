@@ -5,8 +5,13 @@
 #include <iostream>
 #include <numeric>
 
+#include "./span.h"
+
 using complexd_t = std::complex<double>;
 
+// Bohr radius in metres
+inline const double a0 = 0.529e-10;
+
 struct Dims
 {
     int r;
@@ -15,13 +20,27 @@ struct Dims
 };
 
 double fracfac(int i, int j);
+double energy(int n);
 int prod(int i, int j);
 complexd_t Ylm(int l, int m, double theta, double phi);
 complexd_t Rnl(int n, int l, double r);
+double Rnl_envelope(int n, int l, double r);
+double Rnl_bound(int n, int l, double r_min, double r_max);
+double Ylm_bound(int l);
+double radial_cutoff(int n, int l, double tol);
 complexd_t psi_nlm(int n, int l, int m, double r, double theta, double phi);
 void linspace(double start, double stop, int n, double* array);
 complexd_t* psi_arr(int n, int l, int m, Dims dims);
 double *abs_psi_sq(int n, int l, int m, Dims dims);
+void spherical_from_cart(double cart[3], double *sph);
+void plane_basis(double phi_c, double theta_c, double unit_xp[3], double unit_yp[3], double unit_zp[3]);
 void convert_to_basis(double v[3], double e1[3], double e2[3], double e3[3], double res[3]);
+void rotate_azimuth(complexd_t *psi, int size, int m, double delta_phi_c);
+void complex_to_color(complexd_t c, double *col_arr);
+complexd_t *get_psi(int n, int l, int m, double phi_c, double theta_c, double xmin, double xmax, double ymin, double ymax, int n_x, int n_y);
+void get_psi(int n, int l, int m, double phi_c, double theta_c, double xmin, double xmax, double ymin, double ymax, int n_x, int n_y, complexd_t *psi);
 double *get_colors(int n, int l, int m, double phi_c, double theta_c, double xmin, double xmax, double ymin, double ymax, int n_x, int n_y, double normalization_const=1e15);
+void get_colors(int n, int l, int m, double phi_c, double theta_c, double xmin, double xmax, double ymin, double ymax, int n_x, int n_y, OutputSpan<float> rgb, double normalization_const=1e15);
+void get_colors(int n, int l, int m, double phi_c, double theta_c, double xmin, double xmax, double ymin, double ymax, int n_x, int n_y, OutputSpan<unsigned char> rgba8, double normalization_const=1e15);
+void store_psi(const complexd_t *psi, int size, OutputSpan<float> out);
 double *get_colors2_electric_boogaloo(int n, int l, int m, double phi_c, double theta_c, double xmin, double xmax, double ymin, double ymax, double zmax, int n_x, int n_y, int n_z);
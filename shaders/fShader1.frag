@@ -3,6 +3,33 @@ out vec4 FragColor;
 in vec3 ourColor;
 uniform float alpha = 1.0;
 
+// The slice stores (Re psi, Im psi, 0) instead of a colour, so that
+// sensitivity and scaling only change uniforms and not the vertices
+uniform bool complexColors = false;
+// |psi| that is shown at full brightness
+uniform float normalization = 1e15;
+uniform float gamma = 1.0;
+// Logarithmic brightness, with 1/512 of full brightness mapped to black
+uniform bool logScale = false;
+
+const float pi = 3.14159265358979;
+
 void main() {
-    FragColor = vec4(ourColor, alpha);
+    if (!complexColors) {
+        FragColor = vec4(ourColor, alpha);
+        return;
+    }
+    vec2 psi = ourColor.xy / normalization;
+    float magnitude = length(psi);
+    if (magnitude == 0.0) {
+        FragColor = vec4(0.0, 0.0, 0.0, alpha);
+        return;
+    }
+    if (logScale)
+        magnitude = max(0.0, 1.0 + log2(magnitude) / 9.0);
+    magnitude = pow(magnitude, 1.0 / gamma);
+
+    // Same phase colour map as complex_to_color
+    vec3 s = sin(atan(psi.y, psi.x) / 2.0 + vec3(0.0, pi/3.0, 2.0*pi/3.0));
+    FragColor = vec4(magnitude * s * s, alpha);
 }